@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include "hashtable.h"
+
+/*
+ * Hashtable microbenchmarks: insert, lookup hit, lookup miss and a mixed
+ * workload, for both engines, over table sizes from 1k keys up to the size
+ * given on the command line, several key lengths and load factors. Prints
+ * ns/op and, where perf counters can be opened, cache misses per op, next to
+ * the probe lengths hashtable_stats() reports for the table.
+ *
+ * usage: hashtable_bench [max keys]	(default 1000000, 100000000 for the
+ * full range, which takes several GB)
+ */
+
+#define MIN_KEYS 1000
+#define DEFAULT_MAX_KEYS 1000000
+#define MAX_KEY_LEN 64
+
+// how full the table is when measured, relative to its growth threshold
+static const double fills[] = { 0.55, 0.75, 0.99 };
+
+static const size_t key_lens[] = { 8, 16, 32 };
+
+static const struct {
+	const char *name;
+	hashtable_engine_t engine;
+} engines[] = {
+	{"linear", HASHTABLE_LINEAR},
+	{"swiss", HASHTABLE_SWISS},
+};
+
+// a cache miss counter for this thread, -1 if perf is not available
+static int perf_open(void)
+{
+	struct perf_event_attr attr = { 0 };
+
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	errno = 0;
+	return fd;
+}
+
+static void perf_start(int fd)
+{
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static uint64_t perf_stop(int fd)
+{
+	uint64_t count = 0;
+
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (sizeof(count) != read(fd, &count, sizeof(count))) {
+			count = 0;
+		}
+	}
+	return count;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// key i of len bytes, prefix 'k' for keys that get inserted and 'm' for
+// misses. the index is written in hex at the end, so keys of one length
+// differ in their last bytes like most real ids do
+static const char *make_key(char *buf, char prefix, uint64_t i, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	memset(buf, prefix, len);
+	buf[len] = 0;
+	for (size_t pos = len; i && pos > 1; i >>= 4) {
+		buf[--pos] = digits[i & 0xF];
+	}
+	return buf;
+}
+
+typedef struct result_t {
+	double ns;
+	double misses;
+} result_t;
+
+typedef enum op_t {
+	OP_INSERT,
+	OP_HIT,
+	OP_MISS,
+	// 80% hits, 10% inserts of new keys, 10% removes of old ones
+	OP_MIXED
+} op_t;
+
+static void run_op(hashtable_t * table, op_t op, size_t n, size_t len,
+		   int perf_fd, result_t * result)
+{
+	char key[MAX_KEY_LEN + 1];
+	size_t next = n;
+	size_t oldest = 0;
+	size_t found = 0;
+
+	perf_start(perf_fd);
+	double start = now_ns();
+
+	for (size_t i = 0; i < n; ++i) {
+		switch (op) {
+		case OP_INSERT:
+			hashtable_insert(table, make_key(key, 'k', i, len),
+					 (void *)(uintptr_t) (i + 1));
+			break;
+		case OP_HIT:
+			found += NULL != hashtable_lookup(table,
+							  make_key(key, 'k', i,
+								   len));
+			break;
+		case OP_MISS:
+			found += NULL != hashtable_lookup(table,
+							  make_key(key, 'm', i,
+								   len));
+			break;
+		case OP_MIXED:
+			if (i % 10 == 0) {
+				hashtable_insert(table,
+						 make_key(key, 'k', next, len),
+						 (void *)(uintptr_t) (next + 1));
+				++next;
+			} else if (i % 10 == 5) {
+				hashtable_remove(table,
+						 make_key(key, 'k', oldest++,
+							  len));
+			} else {
+				found += NULL !=
+				    hashtable_lookup(table,
+						     make_key(key, 'k',
+							      oldest +
+							      i % (next -
+								   oldest),
+							      len));
+			}
+			break;
+		}
+	}
+
+	double elapsed = now_ns() - start;
+	uint64_t misses = perf_stop(perf_fd);
+
+	// keeps the lookups from being optimized out
+	if (found > n) {
+		abort();
+	}
+
+	result->ns = elapsed / n;
+	result->misses = perf_fd >= 0 ? (double)misses / n : -1;
+}
+
+// the key count that leaves a table of about n keys fill of the way to its
+// next resize
+static size_t keys_for(hashtable_engine_t engine, size_t n, double fill)
+{
+	double max_load = HASHTABLE_SWISS == engine ? 7.0 / 8 : 0.75;
+	size_t slots = 8;
+
+	while (slots * max_load < n) {
+		slots *= 2;
+	}
+	return slots * max_load * fill;
+}
+
+static void print_result(const char *op, const result_t * result)
+{
+	if (result->misses < 0) {
+		printf(" %s %7.1f ns", op, result->ns);
+	} else {
+		printf(" %s %7.1f ns %5.2f miss", op, result->ns,
+		       result->misses);
+	}
+}
+
+static void bench(size_t size, size_t len, double fill, int perf_fd)
+{
+	for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); ++e) {
+		hashtable_options_t options = {.engine = engines[e].engine };
+		hashtable_t *table = create_table_opts(NULL, NULL, &options);
+		size_t n = keys_for(engines[e].engine, size, fill);
+
+		if (!table) {
+			fprintf(stderr, "unable to create table\n");
+			exit(EXIT_FAILURE);
+		}
+
+		result_t insert, hit, miss, mixed;
+		run_op(table, OP_INSERT, n, len, perf_fd, &insert);
+		run_op(table, OP_HIT, n, len, perf_fd, &hit);
+		run_op(table, OP_MISS, n, len, perf_fd, &miss);
+
+		// probe lengths of the freshly filled table, before the mixed
+		// run leaves tombstones behind
+		hashtable_stats_t stats;
+		hashtable_stats(table, &stats);
+
+		run_op(table, OP_MIXED, n, len, perf_fd, &mixed);
+
+		printf("%-6s %10zu keys %2zu B load %.2f probe %.2f/%-3" PRIu32,
+		       engines[e].name, n, len, stats.load_factor,
+		       stats.avg_probe, stats.max_probe);
+		print_result("insert", &insert);
+		print_result("hit", &hit);
+		print_result("miss", &miss);
+		print_result("mixed", &mixed);
+		printf("\n");
+
+		hashtable_destroy(&table);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t max_keys = argc > 1 ? strtoull(argv[1], NULL, 10) :
+	    DEFAULT_MAX_KEYS;
+	int perf_fd = perf_open();
+
+	if (max_keys < MIN_KEYS) {
+		max_keys = MIN_KEYS;
+	}
+	if (perf_fd < 0) {
+		printf("perf counters unavailable, no cache miss counts\n");
+	}
+
+	for (size_t size = MIN_KEYS; size <= max_keys; size *= 10) {
+		for (size_t l = 0; l < sizeof(key_lens) / sizeof(*key_lens);
+		     ++l) {
+			for (size_t f = 0; f < sizeof(fills) / sizeof(*fills);
+			     ++f) {
+				bench(size, key_lens[l], fills[f], perf_fd);
+			}
+		}
+		printf("\n");
+	}
+
+	if (perf_fd >= 0) {
+		close(perf_fd);
+	}
+	return 0;
+}
@@ -1,9 +1,14 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "hashtable.h"
 
 #define movie_list "Movies.txt"
+// with --snapshot, written on the first run and mapped instead of parsing
+// movie_list on later ones, until movie_list changes
+#define movie_snapshot "Movies.snap"
 
 // https://benhoyt.com/writings/hash-table-in-c/
 
@@ -12,6 +17,9 @@ void destroy_person(void *data);
 
 void print_movie(void *data);
 void destroy_movie(void *data);
+size_t save_movie(const void *data, void *buf, size_t size);
+hashtable_t *load_movies(const char *path);
+uint64_t file_stamp(const char *path);
 
 typedef struct person_t {
 	int age;
@@ -19,50 +27,43 @@ typedef struct person_t {
 
 } person_t;
 
+// one allocation, so a snapshot can store it as is
 typedef struct movie_t {
-	char *title;
 	int year;
+	char title[];
 } movie_t;
 
-int main(void)
+int main(int argc, char **argv)
 {
-	hashtable_t *hashtable = create_table(print_movie, destroy_movie);
-	if (!hashtable) {
-		printf("Unable to create hashtable\n");
-		exit(EXIT_FAILURE);
+	bool use_snapshot = argc > 1 && 0 == strcmp(argv[1], "--snapshot");
+	uint64_t stamp = use_snapshot ? file_stamp(movie_list) : 0;
+	hashtable_t *hashtable = NULL;
+
+	if (use_snapshot) {
+		hashtable = hashtable_load(movie_snapshot, print_movie, NULL,
+					   stamp);
+		if (!hashtable && ESTALE == errno) {
+			fprintf(stderr, "%s is older than %s, rebuilding it\n",
+				movie_snapshot, movie_list);
+		} else if (!hashtable && EINVAL == errno) {
+			fprintf(stderr, "%s is not a snapshot, rebuilding it\n",
+				movie_snapshot);
+		}
+		errno = 0;
 	}
 
-	FILE *fp = fopen(movie_list, "r");
-	// TODO error handling
-
-	char line_buff[256] = { 0 };
-
-	while (fgets(line_buff, 255, fp) != NULL) {
-
-		line_buff[strcspn(line_buff, "\n") - 1] = 0;
-
-		movie_t *mov = calloc(1, sizeof(movie_t));
-
-		if (!mov) {
-			continue ;
+	if (!hashtable) {
+		hashtable = load_movies(movie_list);
+		if (!hashtable) {
+			printf("Unable to create hashtable\n");
+			exit(EXIT_FAILURE);
 		}
-
-		char * year_ptr = strrchr(line_buff, ' ');
-
-		if (!year_ptr) {
-//			fprintf(stderr, "Skipped: %s\n", line_buff);
-			free(mov);
-			continue;
+		if (use_snapshot
+		    && !hashtable_save(hashtable, movie_snapshot, save_movie,
+				       stamp)) {
+			fprintf(stderr, "Unable to save %s\n", movie_snapshot);
 		}
-		*year_ptr = 0;
-		mov->year = atoi(year_ptr + 1);
-		mov->title = strdup(line_buff);
-		*year_ptr = ' ';
-
-		hashtable_insert(hashtable, line_buff, mov);
 	}
-
-	fclose(fp);
 //	hashtable_display(hashtable);
 	movie_t *mov = hashtable_lookup(hashtable, "Skippy 1931");
 	if (mov) {
@@ -91,6 +92,113 @@ void destroy_person(void *data)
 	p = NULL;
 }
 
+// identifies the contents of path by its size and modification time, 0 if
+// it cannot be read
+uint64_t file_stamp(const char *path)
+{
+	struct stat st;
+
+	if (0 != stat(path, &st)) {
+		return 0;
+	}
+
+	uint64_t fields[3] = {
+		(uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec,
+		(uint64_t)st.st_mtim.tv_nsec
+	};
+	return hash_wyhash(fields, sizeof(fields), 0);
+}
+
+hashtable_t *load_movies(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return NULL;
+	}
+
+	size_t count = 0;
+	size_t capacity = 1024;
+	char **titles = malloc(capacity * sizeof(char *));
+	movie_t **movies = malloc(capacity * sizeof(movie_t *));
+
+	char line_buff[256] = { 0 };
+
+	while (titles && movies && fgets(line_buff, 255, fp) != NULL) {
+
+		// lines end in a space before the newline
+		size_t len = strcspn(line_buff, "\n");
+		while (len && ' ' == line_buff[len - 1]) {
+			--len;
+		}
+		line_buff[len] = 0;
+
+		char * year_ptr = strrchr(line_buff, ' ');
+
+		if (!year_ptr) {
+//			fprintf(stderr, "Skipped: %s\n", line_buff);
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity *= 2;
+			char **more_titles = realloc(titles,
+						     capacity * sizeof(char *));
+			if (more_titles) {
+				titles = more_titles;
+			}
+			movie_t **more_movies = realloc(movies,
+							capacity *
+							sizeof(movie_t *));
+			if (more_movies) {
+				movies = more_movies;
+			}
+			if (!more_titles || !more_movies) {
+				break;
+			}
+		}
+
+		size_t title_len = year_ptr - line_buff;
+		movie_t *mov = malloc(sizeof(movie_t) + title_len + 1);
+		char *title = strdup(line_buff);
+
+		if (!mov || !title) {
+			free(mov);
+			free(title);
+			continue ;
+		}
+
+		mov->year = atoi(year_ptr + 1);
+		memcpy(mov->title, line_buff, title_len);
+		mov->title[title_len] = 0;
+
+		titles[count] = title;
+		movies[count] = mov;
+		++count;
+	}
+
+	fclose(fp);
+
+	hashtable_t *hashtable = NULL;
+	if (titles && movies) {
+		hashtable = hashtable_build_from((const char *const *)titles,
+						 (void *const *)movies, count,
+						 print_movie, destroy_movie,
+						 NULL);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		free(titles[i]);
+		if (!hashtable) {
+			destroy_movie(movies[i]);
+		}
+	}
+	free(titles);
+	free(movies);
+
+	return hashtable;
+}
+
 void print_movie(void *data)
 {
 	if (!data) {
@@ -104,8 +212,16 @@ void print_movie(void *data)
 
 void destroy_movie(void *data)
 {
-	movie_t *p = (movie_t *) data;
-	free(p->title);
-	free(p);
-	p = NULL;
+	free(data);
+}
+
+size_t save_movie(const void *data, void *buf, size_t size)
+{
+	const movie_t *p = (const movie_t *)data;
+	size_t bytes = sizeof(movie_t) + strlen(p->title) + 1;
+
+	if (bytes <= size) {
+		memcpy(buf, p, bytes);
+	}
+	return bytes;
 }
@@ -1,14 +1,268 @@
+#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "hashtable.h"
 
+// slot arrays start at LOAD_FACTOR slots and double, so their size is
+// always a power of two
 #define LOAD_FACTOR 8
 #define MAX_LOAD .75
+// 2^32 / golden ratio, for fibonacci hashing in hash_home()
+#define FIB_MULT 0x9E3779B9u
+
+// old slots moved to the new array per insert or remove while a resize is in
+// progress
+#define MIGRATE_BATCH 64
+
+// key arena chunks start small and double up to ARENA_CHUNK_MAX bytes
+#define ARENA_CHUNK_MIN 4096
+#define ARENA_CHUNK_MAX (1 << 20)
+
+// concurrent mode: writer lock stripes, picked by the top bits of the hash
+#define STRIPE_BITS 6
+#define STRIPES (1u << STRIPE_BITS)
+#define CACHE_LINE 64
+// smallest concurrent slot array, leaves room for the STRIPES inserts that
+// may race past the load check at once
+#define SHARED_MIN_LOAD (16 * STRIPES)
+
+// bulk builds give each thread at least this many keys, parallel walks at
+// least this many slots
+#define BUILD_MIN_PART 4096
+#define WALK_MIN_PART 16384
+#define MAX_PARTS 64
+
+// lookups hashed and prefetched ahead of resolving them in lookup_many
+#define LOOKUP_BATCH 16
+
+// snapshot file layout, see hashtable_save()
+#define IMAGE_MAGIC 0x3250414e53544448ULL
+#define IMAGE_SLOTS 64
+#define IMAGE_ALIGN 16
+#define IMAGE_MIN_LOAD 16
+
+// home slot of hashed in an array of load slots, load a power of two.
+// fibonacci hashing: the multiply folds every bit of the hash into the top
+// ones, which become the index, so hashes that differ only in their low bits
+// (crc32c of keys that differ in the last byte) still spread over the table,
+// and no division is needed
+static inline uint32_t hash_home(uint32_t hashed, uint32_t load)
+{
+	// widened so that a load of 1 shifts everything out instead of by 32
+	return ((uint64_t)(uint32_t)(hashed * FIB_MULT) << __builtin_ctz(load))
+	    >> 32;
+}
+
+static struct hash_shared_t *shared_create(void);
+static void shared_destroy(hashtable_t * table);
+static bool shared_insert(hashtable_t * table, const char *key, void *data);
+static bool shared_remove(hashtable_t * table, const char *key);
+static void *shared_lookup(hashtable_t * table, const char *key);
+static void image_destroy(hashtable_t * table);
+static void *image_lookup(hashtable_t * table, const char *key, size_t len,
+			  uint32_t hashed);
+static void image_prefetch(const hashtable_t * table, uint32_t hashed);
+static void image_display(hashtable_t * table, user_print_func display);
+
+// swiss engine: slots are probed in aligned groups of GROUP_SIZE control bytes
+#define GROUP_SIZE 16
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+static uint8_t *alloc_ctrl(uint32_t load)
+{
+	uint8_t *ctrl = aligned_alloc(GROUP_SIZE, load);
+	if (ctrl) {
+		memset(ctrl, CTRL_EMPTY, load);
+	}
+	return ctrl;
+}
+
+static bool array_alloc(hash_array_t * array, hashtable_engine_t engine,
+			uint32_t load)
+{
+	array->load = load;
+	array->ctrl = NULL;
+
+	// calloc leaves every slot empty
+	array->slots = calloc(load, sizeof(hash_slot_t));
+	if (HASHTABLE_SWISS == engine) {
+		array->ctrl = alloc_ctrl(load);
+	}
+
+	if (!array->slots || (HASHTABLE_SWISS == engine && !array->ctrl)) {
+		free(array->slots);
+		free(array->ctrl);
+		memset(array, 0, sizeof(*array));
+		return false;
+	}
+
+	return true;
+}
+
+static void array_free(hash_array_t * array)
+{
+	free(array->slots);
+	free(array->ctrl);
+	memset(array, 0, sizeof(*array));
+}
+
+// hash of a key of len bytes with the table's hash function
+static inline uint32_t table_hash(const hashtable_t * table, const char *key,
+				  size_t len)
+{
+	return table->hash(key, len);
+}
+
+/*
+ * Key arena. Keys longer than HASH_INLINE_KEY are bump allocated from a list
+ * of chunks, so loading n keys costs a handful of mallocs instead of n, and a
+ * resize moves key pointers without touching the strings. A removed key does
+ * not give its bytes back. Once more than half of the arena is dead, the next
+ * resize copies the live keys into a fresh arena as it migrates them.
+ */
+struct key_chunk_t {
+	struct key_chunk_t *next;
+	size_t size;
+	size_t used;
+	char bytes[];
+};
+
+// copy of the len byte key in arena, NULL if a new chunk could not be had
+static char *arena_store(key_arena_t * arena, const char *key, size_t len)
+{
+	struct key_chunk_t *chunk = arena->chunks;
+	size_t need = len + 1;
+
+	if (!chunk || chunk->size - chunk->used < need) {
+		size_t size = chunk ? chunk->size * 2 : ARENA_CHUNK_MIN;
+		if (size > ARENA_CHUNK_MAX) {
+			size = ARENA_CHUNK_MAX;
+		}
+		if (size < need) {
+			size = need;
+		}
+
+		chunk = malloc(sizeof(struct key_chunk_t) + size);
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->next = arena->chunks;
+		chunk->size = size;
+		chunk->used = 0;
+		arena->chunks = chunk;
+	}
+
+	char *copy = chunk->bytes + chunk->used;
+	memcpy(copy, key, need);
+	chunk->used += need;
+	arena->used += need;
+
+	return copy;
+}
+
+// moves all of src's chunks into dst
+static void arena_adopt(key_arena_t * dst, key_arena_t * src)
+{
+	struct key_chunk_t **tail = &dst->chunks;
+
+	while (*tail) {
+		tail = &(*tail)->next;
+	}
+	*tail = src->chunks;
+	dst->used += src->used;
+
+	*src = (key_arena_t) {
+	0};
+}
+
+static void arena_free(key_arena_t * arena)
+{
+	struct key_chunk_t *chunk = arena->chunks;
+
+	while (chunk) {
+		struct key_chunk_t *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	*arena = (key_arena_t) {
+	0};
+}
+
+// whether slot holds key, which is len bytes long
+static inline bool slot_has_key(const hash_slot_t * slot, const char *key,
+				size_t len)
+{
+	if (HASH_KEY_EXTERN != slot->key_len) {
+		return len == slot->key_len
+		    && !memcmp(slot->key.bytes, key, len);
+	}
+	return !strcmp(slot->key.ptr, key);
+}
+
+// fills in the key of slot, inline if it fits and in arena otherwise. live
+// counts the arena bytes in use
+static bool slot_store_key(key_arena_t * arena, size_t *live,
+			   hash_slot_t * slot, const char *key, size_t len)
+{
+	if (len <= HASH_INLINE_KEY) {
+		memcpy(slot->key.bytes, key, len + 1);
+		slot->key_len = len;
+		return true;
+	}
+
+	slot->key.ptr = arena_store(arena, key, len);
+	slot->key_len = HASH_KEY_EXTERN;
+	if (!slot->key.ptr) {
+		return false;
+	}
+
+	*live += len + 1;
+	return true;
+}
+
+static inline const char *slot_key(const hash_slot_t * slot)
+{
+	return HASH_KEY_EXTERN == slot->key_len ? slot->key.ptr :
+	    slot->key.bytes;
+}
+
+// lets go of the key of slot, arena bytes just stop counting as live
+static void slot_drop_key(hashtable_t * table, const hash_slot_t * slot)
+{
+	if (HASH_KEY_EXTERN == slot->key_len) {
+		table->key_bytes -= strlen(slot->key.ptr) + 1;
+	}
+}
 
 hashtable_t *create_table(user_print_func print, user_free_func destroy)
 {
+	return create_table_opts(print, destroy, NULL);
+}
+
+hashtable_t *create_table_opts(user_print_func print, user_free_func destroy,
+			       const hashtable_options_t * options)
+{
+	hashtable_engine_t engine = options ? options->engine : HASHTABLE_LINEAR;
+	bool concurrent = options && options->concurrent;
+	if (HASHTABLE_LINEAR != engine && HASHTABLE_SWISS != engine) {
+		return NULL;
+	}
+	// swiss deletion and group probing have no lock-free reader protocol
+	if (concurrent && HASHTABLE_SWISS == engine) {
+		return NULL;
+	}
 
 	hashtable_t *table = calloc(1, sizeof(hashtable_t));
 	if (!table) {
@@ -17,13 +271,24 @@ hashtable_t *create_table(user_print_func print, user_free_func destroy)
 		return NULL;
 	}
 
-	table->load = LOAD_FACTOR;
+	table->engine = engine;
 	table->count = 0;
 
-	// allocate memory for initial entries array
-	table->buckets = calloc(table->load, sizeof(hash_node_t *));
-	if (!table->buckets) {
-		perror("hashtable buckets calloc");
+	// allocate memory for initial slot array, a swiss table is at least
+	// one group and always a power of two. a concurrent table keeps its
+	// arrays in its shared state instead
+	if (concurrent) {
+		table->shared = shared_create();
+	} else if (!array_alloc(&table->current, engine,
+				HASHTABLE_SWISS == engine ? GROUP_SIZE :
+				LOAD_FACTOR)) {
+		perror("hashtable slots calloc");
+		errno = 0;
+		free(table);
+		return NULL;
+	}
+	if (concurrent && !table->shared) {
+		perror("hashtable shared calloc");
 		errno = 0;
 		free(table);
 		return NULL;
@@ -31,29 +296,47 @@ hashtable_t *create_table(user_print_func print, user_free_func destroy)
 	// initialize table lock
 	if (0 != pthread_mutex_init(&table->table_lock, NULL)) {
 		perror("pthread initialization");
-		free(table->buckets);
+		array_free(&table->current);
+		shared_destroy(table);
 		free(table);
 		return NULL;
 	}
 
 	table->print = print;
 	table->destroy = destroy;
+	table->hash = options && options->hash ? options->hash : hash_crc32c;
 
 	return table;
 }
 
-static void destroy_hashtable_entry(hash_node_t * entry, user_free_func destroy)
+static void destroy_hashtable_entry(const hashtable_t * table,
+				    hash_slot_t * slot)
 {
-	if (!entry) {
+	if (SLOT_FULL != slot->state) {
 		return;
 	}
 
-	if (destroy && entry->data) {
-		destroy(entry->data);
+	if (table->destroy && slot->data) {
+		table->destroy(slot->data);
 	}
-	free(entry->key);
-	free(entry);
-	entry = NULL;
+	// arena keys go with the arena, concurrent tables own heap keys
+	if (table->shared) {
+		free(slot->key.ptr);
+	}
+	slot->key.ptr = NULL;
+	slot->data = NULL;
+	slot->state = SLOT_DELETED;
+}
+
+static void destroy_array(const hashtable_t * table, hash_array_t * array)
+{
+	// free slot contents
+	for (uint64_t i = 0; i < array->load; ++i) {
+		destroy_hashtable_entry(table, &array->slots[i]);
+	}
+
+	// free slot array
+	array_free(array);
 }
 
 void hashtable_destroy(hashtable_t ** table)
@@ -66,14 +349,12 @@ void hashtable_destroy(hashtable_t ** table)
 
 	pthread_mutex_lock(&t->table_lock);
 
-	// free buckets
-	for (uint64_t i = 0; i < t->load; ++i) {
-		hash_node_t *entry = t->buckets[i];
-		destroy_hashtable_entry(entry, t->destroy);
-	}
-
-	// free buckets array
-	free(t->buckets);
+	destroy_array(t, &t->current);
+	destroy_array(t, &t->old);
+	shared_destroy(t);
+	image_destroy(t);
+	arena_free(&t->keys);
+	arena_free(&t->old_keys);
 
 	// destroy table lock
 	pthread_mutex_unlock(&t->table_lock);
@@ -84,162 +365,2557 @@ void hashtable_destroy(hashtable_t ** table)
 
 }
 
-static void pack_new_table(hashtable_t ** old_table)
+/*
+ * Swiss engine. ctrl[i] is CTRL_EMPTY, CTRL_DELETED or, for a full slot, the
+ * low 7 bits of its hash (h2). The rest of the hash (h1) picks the first
+ * group the way hash_home() picks a slot, so the tag and the group come from
+ * disjoint bits, and later groups follow a triangular sequence that visits
+ * every group of a power of two table exactly once. One SIMD compare checks a
+ * whole group against h2, so a probe only looks at slots whose tag matches
+ * and stops at the first group with an empty slot.
+ */
+static inline uint8_t hash_h2(uint32_t hashed)
 {
-	uint32_t curr_size = (*old_table)->load;
+	return hashed & 0x7F;
+}
 
-	hashtable_t temp_table = { 0 };
-    temp_table.load = curr_size * 2;
-	
-	(*old_table)->load *= 2;
+// first group a probe for hashed visits in an array of load slots
+static inline uint32_t hash_group(uint32_t hashed, uint32_t load)
+{
+	return hash_home(hashed >> 7, load / GROUP_SIZE);
+}
 
-	hash_node_t **new_buckets =
-	    calloc((*old_table)->load, sizeof(hash_node_t *));
+// bit i set where group[i] == tag
+static inline uint32_t group_match(const uint8_t * group, uint8_t tag)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_load_si128((const __m128i *)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; ++i) {
+		mask |= (uint32_t)(group[i] == tag) << i;
+	}
+	return mask;
+#endif
+}
 
-	if (!new_buckets) {
-		perror("hashtable realloc");
-		errno = 0;
-		(*old_table)->load /= 2;
-		fprintf(stderr, "insertion failed\n");
-		return;
+// bit i set where group[i] is empty or deleted, both have the top bit set
+static inline uint32_t group_match_free(const uint8_t * group)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; ++i) {
+		mask |= (uint32_t)(group[i] >> 7) << i;
+	}
+	return mask;
+#endif
+}
+
+// index of the first free slot on the probe sequence, the array must have room
+static uint32_t swiss_find_free(const hash_array_t * array, uint32_t hashed)
+{
+	uint32_t group_mask = array->load / GROUP_SIZE - 1;
+	uint32_t group = hash_group(hashed, array->load);
+
+	for (uint32_t step = 1;; ++step) {
+		uint32_t mask = group_match_free(array->ctrl +
+						 group * GROUP_SIZE);
+		if (mask) {
+			return group * GROUP_SIZE + __builtin_ctz(mask);
+		}
+		group = (group + step) & group_mask;
 	}
+}
+
+static hash_slot_t *swiss_find(const hash_array_t * array, const char *key,
+			       size_t len, uint32_t hashed)
+{
+	uint8_t tag = hash_h2(hashed);
+	uint32_t group_mask = array->load / GROUP_SIZE - 1;
+	uint32_t group = hash_group(hashed, array->load);
 
-    temp_table.buckets = new_buckets;
+	for (uint32_t step = 1; step <= group_mask + 1; ++step) {
+		const uint8_t *ctrl = array->ctrl + group * GROUP_SIZE;
 
-	for (uint64_t i = 0; i < (*old_table)->load / 2; ++i) {
-		if ((*old_table)->buckets[i] && (*old_table)->buckets[i]->data
-		    && !(*old_table)->buckets[i]->deleted) {
+		for (uint32_t mask = group_match(ctrl, tag); mask;
+		     mask &= mask - 1) {
+			hash_slot_t *slot = &array->slots[group * GROUP_SIZE +
+							   __builtin_ctz(mask)];
 
-			hashtable_insert(&temp_table, (*old_table)->buckets[i]->key,
-					 (*old_table)->buckets[i]->data);
+			if (hashed == slot->hash
+			    && slot_has_key(slot, key, len)) {
+				return slot;
+			}
+		}
 
-            destroy_hashtable_entry((*old_table)->buckets[i], NULL);
+		// an empty slot ends the probe sequence
+		if (group_match(ctrl, CTRL_EMPTY)) {
+			break;
 		}
-    }
+		group = (group + step) & group_mask;
+	}
+	// not found
+	return NULL;
+}
+
+/*
+ * Linear engine: probes one slot at a time from hash_home(), wrapping around
+ * with a mask.
+ */
+static hash_slot_t *linear_find(const hash_array_t * array, const char *key,
+				size_t len, uint32_t hashed)
+{
+	uint32_t mask = array->load - 1;
+	uint32_t index = hash_home(hashed, array->load);
 
-    free((*old_table)->buckets);
-	(*old_table)->buckets = temp_table.buckets;
+	// check for key, only a matching cached hash is worth a strcmp
+	while (SLOT_EMPTY != array->slots[index].state) {
+		hash_slot_t *slot = &array->slots[index];
 
+		if (SLOT_FULL == slot->state && hashed == slot->hash
+		    && slot_has_key(slot, key, len)) {
+			return slot;
+		}
 
+		index = (index + 1) & mask;
+	}
+	// not found
+	return NULL;
 }
 
-bool hashtable_insert(hashtable_t * table, const char *key, void *data)
+// first free slot on the probe sequence of hashed, the array must have room
+static uint32_t linear_find_free(const hash_array_t * array, uint32_t hashed)
 {
-	if (!table || !key) {
-		return false;
+	uint32_t mask = array->load - 1;
+	uint32_t index = hash_home(hashed, array->load);
+
+	// handle collision by linear probing (incrementing index)
+	while (SLOT_FULL == array->slots[index].state) {
+		index = (index + 1) & mask;
 	}
-    
-	if (((float)(table->count + 1) / table->load) > MAX_LOAD) {
-		pack_new_table(&table);
+
+	return index;
+}
+
+// slot holding key in array, NULL if there is none
+static hash_slot_t *array_find(const hashtable_t * table,
+			       const hash_array_t * array, const char *key,
+			       size_t len, uint32_t hashed)
+{
+	if (!array->slots) {
+		return NULL;
 	}
 
-	uint32_t hashed = hash_crc32(key);
-	uint32_t index = hashed % (table->load);
+	if (HASHTABLE_SWISS == table->engine) {
+		return swiss_find(array, key, len, hashed);
+	}
+	return linear_find(array, key, len, hashed);
+}
 
+// claims a free slot for entry's hash in array and copies entry into it
+static hash_slot_t *array_place(hashtable_t * table, hash_array_t * array,
+				const hash_slot_t * entry)
+{
+	uint32_t hashed = entry->hash;
+	uint32_t index;
 
-	// check for collision
-	while (NULL != table->buckets[index]) {
-		// handle collision by linear probing (incrementing index)
-		index = (index + 1) % table->load;
+	if (HASHTABLE_SWISS == table->engine) {
+		index = swiss_find_free(array, hashed);
+		if (CTRL_DELETED == array->ctrl[index]
+		    && array == &table->current) {
+			--table->tombstones;
+		}
+		array->ctrl[index] = hash_h2(hashed);
+	} else {
+		index = linear_find_free(array, hashed);
 	}
 
-	// create new entry
-	hash_node_t *new_entry = calloc(1, sizeof(hash_node_t));
-	new_entry->key = strdup(key);
-	new_entry->data = data;
-	new_entry->deleted = false;
+	array->slots[index] = *entry;
+	array->slots[index].state = SLOT_FULL;
 
-	// insert entry
-	table->buckets[index] = new_entry;
-	++table->count;
-	return true;
+	return &array->slots[index];
 }
 
-void * hashtable_lookup(hashtable_t * table, const char *key) {
-	if (!table || !key) {
-		return NULL;
+// turns a full slot into a tombstone, so probes keep walking past it
+static void array_vacate(const hashtable_t * table, hash_array_t * array,
+			 hash_slot_t * slot)
+{
+	if (HASHTABLE_SWISS == table->engine) {
+		array->ctrl[slot - array->slots] = CTRL_DELETED;
 	}
 
-	uint32_t hashed = hash_crc32(key);
-	uint32_t index = hashed % (table->load);
+	slot->state = SLOT_DELETED;
+	slot->key.ptr = NULL;
+	slot->data = NULL;
+}
+
+/*
+ * Backward shift deletion for the linear engine: instead of leaving a
+ * tombstone, pull later entries of the same run back into the hole as long
+ * as that does not move them in front of their home slot. Runs stay as short
+ * as if the key had never been inserted. Only used on the current array,
+ * which never holds tombstones under the linear engine, so a run ends at the
+ * first slot that is not full.
+ */
+static void linear_erase(hash_array_t * array, hash_slot_t * slot)
+{
+	uint32_t load = array->load;
+	uint32_t mask = load - 1;
+	uint32_t hole = slot - array->slots;
+	uint32_t index = (hole + 1) & mask;
+
+	while (SLOT_FULL == array->slots[index].state) {
+		uint32_t home = hash_home(array->slots[index].hash, load);
 
-	// check for key
-	while (NULL != table->buckets[index]) {
-		// find key
-		if (!strcmp(table->buckets[index]->key, key)) {
-	    		return table->buckets[index]->data;
+		// the hole lies between this entry's home and where it sits
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			array->slots[hole] = array->slots[index];
+			hole = index;
 		}
+		index = (index + 1) & mask;
+	}
+
+	array->slots[hole] = (hash_slot_t) {
+	.state = SLOT_EMPTY};
+}
+
+/*
+ * Swiss deletion: a slot can go straight back to empty if its group still
+ * has an empty slot, because no probe sequence ever continued past a group
+ * with an empty slot. Otherwise it becomes a tombstone, which is counted
+ * against the load so that enough of them trigger a compacting rehash.
+ */
+static void swiss_erase(hashtable_t * table, hash_array_t * array,
+			hash_slot_t * slot)
+{
+	uint32_t index = slot - array->slots;
+	const uint8_t *group = array->ctrl + index / GROUP_SIZE * GROUP_SIZE;
 
-		index = (index + 1) % table->load;
+	if (group_match(group, CTRL_EMPTY)) {
+		array->ctrl[index] = CTRL_EMPTY;
+		*slot = (hash_slot_t) {
+		.state = SLOT_EMPTY};
+		return;
+	}
+
+	array_vacate(table, array, slot);
+	if (array == &table->current) {
+		++table->tombstones;
 	}
-	// not found
-	return NULL;
 }
 
-void hashtable_display(hashtable_t * table)
+// removes a full slot from array, its key and data are already released
+static void array_erase(hashtable_t * table, hash_array_t * array,
+			hash_slot_t * slot)
 {
-	if (!table) {
+	if (HASHTABLE_SWISS == table->engine) {
+		swiss_erase(table, array, slot);
+	} else if (array == &table->current) {
+		linear_erase(array, slot);
+	} else {
+		// moving entries around the old array could carry them behind
+		// the migration cursor, a tombstone is safe
+		array_vacate(table, array, slot);
+	}
+}
+
+// moves an arena key out of the arena being compacted. if that fails the
+// compaction is called off and the old chunks stay in use
+static void compact_key(hashtable_t * table, hash_slot_t * entry)
+{
+	char *copy = arena_store(&table->keys, entry->key.ptr,
+				 strlen(entry->key.ptr));
+
+	if (copy) {
+		entry->key.ptr = copy;
+	} else {
+		arena_adopt(&table->keys, &table->old_keys);
+	}
+}
+
+/*
+ * Moves up to budget slots of the old array into the current one. Every slot
+ * keeps its cached hash and key, the vacated old slot becomes a tombstone so
+ * lookups of keys that have not moved yet still find them. Arena keys are
+ * only copied while the arena is being compacted. The old array, and the old
+ * arena if any, are freed once the old array has been walked completely.
+ */
+static void migrate_slots(hashtable_t * table, uint32_t budget)
+{
+	hash_array_t *old = &table->old;
+
+	if (!old->slots) {
 		return;
 	}
 
-	user_print_func display = table->print;
+	while (budget-- && table->migrated < old->load) {
+		hash_slot_t *slot = &old->slots[table->migrated++];
 
-	printf("\n----- HASH TABLE -----\n\n");
-	for (uint32_t i = 0; i < table->load; ++i) {
+		if (SLOT_FULL == slot->state) {
+			hash_slot_t entry = *slot;
+
+			if (table->old_keys.chunks
+			    && HASH_KEY_EXTERN == entry.key_len) {
+				compact_key(table, &entry);
+			}
+			array_place(table, &table->current, &entry);
+			array_vacate(table, old, slot);
+		}
+	}
+
+	if (table->migrated == old->load) {
+		array_free(old);
+		arena_free(&table->old_keys);
+		table->migrated = 0;
+	}
+}
+
+// most slots, tombstones included, an array of load slots may use
+static uint64_t max_fill(const hashtable_t * table, uint32_t load)
+{
+	// 7/8 for swiss, group probing keeps chains short up to there
+	if (HASHTABLE_SWISS == table->engine) {
+		return (uint64_t)load * 7 / 8;
+	}
+	return (uint64_t)(load * MAX_LOAD);
+}
+
+static bool needs_grow(const hashtable_t * table)
+{
+	return (uint64_t)table->count + table->tombstones + 1 >
+	    max_fill(table, table->current.load);
+}
+
+// more than half of the key arena belongs to removed keys
+static bool keys_bloated(const hashtable_t * table)
+{
+	return table->keys.used > ARENA_CHUNK_MIN
+	    && table->keys.used > 2 * table->key_bytes;
+}
+
+/*
+ * Starts a resize: the current array becomes the old one and a new array of
+ * twice the size takes over. Instead of rehashing everything here, every
+ * following insert and remove moves MIGRATE_BATCH old slots, so no single
+ * call pays for the whole table. Lookups leave the table as it is and probe
+ * both arrays meanwhile. When mostly tombstones filled the table up, the new
+ * array keeps the old size and the migration just compacts them away.
+ * Likewise, when most of the key arena belongs to removed keys, the migration
+ * copies the live ones into a new one.
+ *
+ * Only two arrays ever coexist. A grown array takes as many inserts again as
+ * the table held before it fills up, a compacted one at least 7/16 of its
+ * slots, and each of those calls migrates MIGRATE_BATCH slots, so the old
+ * array is long gone by the time the current one needs to grow. The arena
+ * alone never starts a resize while one is in flight.
+ */
+static bool start_resize(hashtable_t * table)
+{
+	assert(!table->old.slots);
+
+	uint32_t load = table->current.load;
+	if ((uint64_t)(table->count + 1) * 2 > max_fill(table, load)) {
+		load *= 2;
+	}
+
+	hash_array_t grown;
+	if (!array_alloc(&grown, table->engine, load)) {
+		perror("hashtable realloc");
+		errno = 0;
+		fprintf(stderr, "insertion failed\n");
+		return false;
+	}
+
+	table->old = table->current;
+	table->current = grown;
+	table->migrated = 0;
+	table->tombstones = 0;
+
+	if (keys_bloated(table)) {
+		table->old_keys = table->keys;
+		table->keys = (key_arena_t) {
+		0};
+	}
+
+	return true;
+}
+
+static void display_array(const hash_array_t * array, user_print_func display)
+{
+	for (uint32_t i = 0; i < array->load; ++i) {
 		printf("[%d]: ", i);
 
-		if (table->buckets[i]) {
-			display(table->buckets[i]->data);
+		if (SLOT_FULL == array->slots[i].state) {
+			display(array->slots[i].data);
 		} else {
 			puts("");
 		}
 	}
-	printf("\n--------- END ---------\n");
-
 }
 
-/**
- * @brief calculates the CRC-32 based on table in function.
- * 
- * @cite adapted from https://web.mit.edu/freebsd/head/sys/libkern/crc32.c
- * 
- * @param str 
- * @return uint32_t 
+/*
+ * Concurrent mode (linear engine only).
+ *
+ * Writers serialize per stripe: every key maps to one of STRIPES locks by its
+ * hash, so two writers only wait on each other when their keys share a
+ * stripe. A writer claims a free slot with a CAS from empty or deleted to
+ * claimed, fills it in and publishes it as full, so writers of different
+ * stripes can share a probe run without a common lock.
+ *
+ * Readers take no lock. Every change to a stripe's keys (insert, update,
+ * remove, migration) runs inside that stripe's seqlock, and a reader only
+ * ever matches slots whose cached hash equals its own, which are in its own
+ * stripe. It reads the stripe sequence, probes, and retries if the sequence
+ * moved. Probe runs never break under it: concurrent mode never empties a
+ * slot, removals leave tombstones. Memory a reader may still be looking at
+ * (removed keys and data, retired arrays) is parked on a retire list until
+ * hashtable_reclaim() or hashtable_destroy().
+ *
+ * Resizing is cooperative. The thread that finds the table full takes every
+ * stripe lock to swap in the new array, then each insert claims a chunk of
+ * MIGRATE_BATCH old slots and copies them over, one stripe lock at a time.
+ * Copied slots become tombstones in the old array. Whichever thread finishes
+ * the last chunk retires the old array.
  */
-uint32_t hash_crc32(const char *str)
+typedef struct stripe_t {
+	pthread_mutex_t lock;
+	atomic_uint seq;
+	char pad[CACHE_LINE - sizeof(pthread_mutex_t) - sizeof(atomic_uint)];
+} stripe_t;
+
+// one resize in flight: the array being copied from and its chunk counters
+typedef struct hash_resize_t {
+	hash_array_t *from;
+	atomic_uint next;
+	atomic_uint done;
+} hash_resize_t;
+
+typedef struct retired_t {
+	struct retired_t *next;
+	hash_array_t *array;
+	hash_resize_t *resize;
+	char *key;
+	void *data;
+} retired_t;
+
+struct hash_shared_t {
+	stripe_t stripes[STRIPES];
+	_Atomic(hash_array_t *) current;
+	_Atomic(hash_resize_t *) resize;
+	pthread_mutex_t resize_lock;
+	pthread_mutex_t retire_lock;
+	retired_t *retired;
+};
+
+static inline stripe_t *key_stripe(hashtable_t * table, uint32_t hashed)
 {
-	size_t length = strlen(str);
-	const uint8_t *data = (const uint8_t *)str;
-
-	uint32_t crc = 0xFFFFFFFF;
-
-	static const uint32_t crc32Table[256] = {
-		0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419,
-		0x706AF48F, 0xE963A535, 0x9E6495A3,
-		0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B,
-		0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
-		0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D,
-		0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-		0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F,
-		0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
-		0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1,
-		0x4B04D447, 0xD20D85FD, 0xA50AB56B,
-		0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3,
-		0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-		0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5,
-		0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
-		0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87,
-		0x58684C11, 0xC1611DAB, 0xB6662D3D,
-		0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589,
-		0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-		0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB,
-		0x086D3D2D, 0x91646C97, 0xE6635C
-	};
+	return &table->shared->stripes[hashed >> (32 - STRIPE_BITS)];
+}
+
+static inline void seq_begin(stripe_t * stripe)
+{
+	unsigned int seq = atomic_load_explicit(&stripe->seq,
+						memory_order_relaxed);
+	atomic_store_explicit(&stripe->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void seq_end(stripe_t * stripe)
+{
+	unsigned int seq = atomic_load_explicit(&stripe->seq,
+						memory_order_relaxed);
+	atomic_store_explicit(&stripe->seq, seq + 1, memory_order_release);
+}
+
+static inline uint32_t slot_state(const hash_slot_t * slot)
+{
+	return __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+}
+
+static hash_array_t *shared_array_alloc(uint32_t load)
+{
+	hash_array_t *array = malloc(sizeof(hash_array_t));
+	if (array && !array_alloc(array, HASHTABLE_LINEAR, load)) {
+		free(array);
+		array = NULL;
+	}
+	return array;
+}
+
+static struct hash_shared_t *shared_create(void)
+{
+	// aligned_alloc wants a size that is a multiple of the alignment
+	size_t size = (sizeof(struct hash_shared_t) + CACHE_LINE - 1) &
+	    ~(size_t)(CACHE_LINE - 1);
+	struct hash_shared_t *shared = aligned_alloc(CACHE_LINE, size);
+	if (!shared) {
+		return NULL;
+	}
+	memset(shared, 0, sizeof(*shared));
 
-	for (size_t i = 0; i < length; ++i) {
-		uint8_t index = (crc ^ data[i]) & 0xFF;
-		crc = (crc >> 8) ^ crc32Table[index];
+	hash_array_t *array = shared_array_alloc(SHARED_MIN_LOAD);
+	if (!array) {
+		free(shared);
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < STRIPES; ++i) {
+		pthread_mutex_init(&shared->stripes[i].lock, NULL);
+		atomic_init(&shared->stripes[i].seq, 0);
+	}
+	atomic_init(&shared->current, array);
+	atomic_init(&shared->resize, NULL);
+	pthread_mutex_init(&shared->resize_lock, NULL);
+	pthread_mutex_init(&shared->retire_lock, NULL);
+
+	return shared;
+}
+
+// parks memory a lock-free reader may still see until the next reclaim
+static void retire(hashtable_t * table, hash_array_t * array,
+		   hash_resize_t * resize, char *key, void *data)
+{
+	struct hash_shared_t *shared = table->shared;
+
+	retired_t *node = malloc(sizeof(retired_t));
+	if (!node) {
+		// nowhere to park it, leaking beats a use after free
+		perror("hashtable retire");
+		errno = 0;
+		return;
 	}
+	*node = (retired_t) {
+	.array = array,.resize = resize,.key = key,.data = data};
+
+	pthread_mutex_lock(&shared->retire_lock);
+	node->next = shared->retired;
+	shared->retired = node;
+	pthread_mutex_unlock(&shared->retire_lock);
+}
 
-	return crc ^ 0xFFFFFFFF;
-}
\ No newline at end of file
+void hashtable_reclaim(hashtable_t * table)
+{
+	if (!table || !table->shared) {
+		return;
+	}
+
+	struct hash_shared_t *shared = table->shared;
+
+	pthread_mutex_lock(&shared->retire_lock);
+	retired_t *node = shared->retired;
+	shared->retired = NULL;
+	pthread_mutex_unlock(&shared->retire_lock);
+
+	while (node) {
+		retired_t *next = node->next;
+
+		if (node->array) {
+			array_free(node->array);
+			free(node->array);
+		}
+		if (table->destroy && node->data) {
+			table->destroy(node->data);
+		}
+		free(node->resize);
+		free(node->key);
+		free(node);
+		node = next;
+	}
+}
+
+static void shared_destroy(hashtable_t * table)
+{
+	struct hash_shared_t *shared = table->shared;
+	if (!shared) {
+		return;
+	}
+
+	hashtable_reclaim(table);
+
+	hash_array_t *current = atomic_load(&shared->current);
+	destroy_array(table, current);
+	free(current);
+
+	hash_resize_t *resize = atomic_load(&shared->resize);
+	if (resize) {
+		destroy_array(table, resize->from);
+		free(resize->from);
+		free(resize);
+	}
+
+	for (uint32_t i = 0; i < STRIPES; ++i) {
+		pthread_mutex_destroy(&shared->stripes[i].lock);
+	}
+	pthread_mutex_destroy(&shared->resize_lock);
+	pthread_mutex_destroy(&shared->retire_lock);
+
+	free(shared);
+	table->shared = NULL;
+}
+
+// lock-free probe, only meaningful inside a validated seqlock read
+static hash_slot_t *shared_find(const hash_array_t * array, const char *key,
+				uint32_t hashed)
+{
+	uint32_t mask = array->load - 1;
+
+	for (uint32_t i = 0, index = hash_home(hashed, array->load);
+	     i < array->load;
+	     ++i, index = (index + 1) & mask) {
+		hash_slot_t *slot = &array->slots[index];
+		uint32_t state = slot_state(slot);
+
+		if (SLOT_EMPTY == state) {
+			break;
+		}
+
+		if (SLOT_FULL == state
+		    && hashed == __atomic_load_n(&slot->hash, __ATOMIC_RELAXED)
+		    && !strcmp(__atomic_load_n(&slot->key.ptr, __ATOMIC_RELAXED),
+			       key)) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+// claims a free slot in array and publishes the entry, caller holds the
+// stripe lock of hashed and is inside its seqlock
+static bool shared_place(hashtable_t * table, hash_array_t * array,
+			 uint32_t hashed, char *key, void *data)
+{
+	uint32_t mask = array->load - 1;
+
+	for (uint32_t i = 0, index = hash_home(hashed, array->load);
+	     i < array->load;
+	     ++i, index = (index + 1) & mask) {
+		hash_slot_t *slot = &array->slots[index];
+		uint16_t state = slot_state(slot);
+
+		if (SLOT_EMPTY != state && SLOT_DELETED != state) {
+			continue;
+		}
+
+		if (!__atomic_compare_exchange_n(&slot->state, &state,
+						 SLOT_CLAIMED, false,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED)) {
+			continue;
+		}
+
+		if (SLOT_DELETED == state
+		    && array == atomic_load(&table->shared->current)) {
+			__atomic_fetch_sub(&table->tombstones, 1,
+					   __ATOMIC_RELAXED);
+		}
+
+		__atomic_store_n(&slot->hash, hashed, __ATOMIC_RELAXED);
+		// concurrent tables keep every key on the heap, removed keys
+		// must outlive the slot for readers still comparing them
+		__atomic_store_n(&slot->key_len, HASH_KEY_EXTERN,
+				 __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->key.ptr, key, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->data, data, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->state, SLOT_FULL, __ATOMIC_RELEASE);
+
+		return true;
+	}
+
+	return false;
+}
+
+static void shared_vacate(hash_slot_t * slot)
+{
+	__atomic_store_n(&slot->state, SLOT_DELETED, __ATOMIC_RELEASE);
+}
+
+// copies one chunk of the resize in flight, if there is one. holds no locks
+static void shared_migrate(hashtable_t * table)
+{
+	struct hash_shared_t *shared = table->shared;
+	hash_resize_t *resize = atomic_load(&shared->resize);
+
+	if (!resize) {
+		return;
+	}
+
+	hash_array_t *from = resize->from;
+	uint32_t first = atomic_fetch_add(&resize->next, MIGRATE_BATCH);
+	if (first >= from->load) {
+		return;
+	}
+
+	uint32_t last = first + MIGRATE_BATCH < from->load ?
+	    first + MIGRATE_BATCH : from->load;
+	hash_array_t *to = atomic_load(&shared->current);
+
+	for (uint32_t i = first; i < last; ++i) {
+		hash_slot_t *slot = &from->slots[i];
+
+		if (SLOT_FULL != slot_state(slot)) {
+			continue;
+		}
+		// the slot's stripe keeps its writers off it while it moves
+		uint32_t hashed = __atomic_load_n(&slot->hash, __ATOMIC_RELAXED);
+		stripe_t *stripe = key_stripe(table, hashed);
+		bool placed = true;
+
+		pthread_mutex_lock(&stripe->lock);
+		if (SLOT_FULL == slot_state(slot)) {
+			seq_begin(stripe);
+			placed = shared_place(table, to, hashed,
+					      __atomic_load_n(&slot->key.ptr,
+							      __ATOMIC_RELAXED),
+					      __atomic_load_n(&slot->data,
+							      __ATOMIC_RELAXED));
+			if (placed) {
+				shared_vacate(slot);
+			}
+			seq_end(stripe);
+		}
+		pthread_mutex_unlock(&stripe->lock);
+
+		// inserts stop short of filling to, so this never happens. if
+		// it did, the entry stays where it is and the chunk is never
+		// done, which keeps the old array, and the entry, reachable
+		assert(placed);
+		if (!placed) {
+			return;
+		}
+	}
+
+	// the last chunk in retires the old array
+	if (atomic_fetch_add(&resize->done, last - first) + (last - first) ==
+	    from->load) {
+		pthread_mutex_lock(&shared->resize_lock);
+		atomic_store(&shared->resize, NULL);
+		pthread_mutex_unlock(&shared->resize_lock);
+
+		retire(table, from, resize, NULL, NULL);
+	}
+}
+
+static bool shared_needs_grow(hashtable_t * table)
+{
+	hash_array_t *current = atomic_load(&table->shared->current);
+	uint64_t used = (uint64_t)__atomic_load_n(&table->count,
+						  __ATOMIC_RELAXED) +
+	    __atomic_load_n(&table->tombstones, __ATOMIC_RELAXED);
+
+	// inserts on other stripes may race past this check, keep room for
+	// each of them
+	return used + STRIPES + 1 > max_fill(table, current->load);
+}
+
+/*
+ * Swaps in a new array with every stripe locked, so no writer is halfway
+ * through placing an entry in the array that is about to become the old one.
+ * Returns false only if the allocation failed, true also when another thread
+ * got there first or a resize is still being copied.
+ */
+static bool shared_start_resize(hashtable_t * table)
+{
+	struct hash_shared_t *shared = table->shared;
+	bool ok = true;
+
+	pthread_mutex_lock(&shared->resize_lock);
+
+	if (atomic_load(&shared->resize) || !shared_needs_grow(table)) {
+		pthread_mutex_unlock(&shared->resize_lock);
+		return true;
+	}
+
+	for (uint32_t i = 0; i < STRIPES; ++i) {
+		pthread_mutex_lock(&shared->stripes[i].lock);
+	}
+
+	hash_array_t *current = atomic_load(&shared->current);
+	uint32_t load = current->load;
+	uint32_t count = __atomic_load_n(&table->count, __ATOMIC_RELAXED);
+	if ((uint64_t)(count + 1) * 2 > max_fill(table, load)) {
+		load *= 2;
+	}
+
+	hash_resize_t *resize = malloc(sizeof(hash_resize_t));
+	hash_array_t *grown = shared_array_alloc(load);
+
+	if (resize && grown) {
+		resize->from = current;
+		atomic_init(&resize->next, 0);
+		atomic_init(&resize->done, 0);
+
+		// readers that see the new array also see where to find the
+		// entries that have not moved yet
+		atomic_store(&shared->resize, resize);
+		atomic_store(&shared->current, grown);
+		__atomic_store_n(&table->tombstones, 0, __ATOMIC_RELAXED);
+	} else {
+		perror("hashtable realloc");
+		errno = 0;
+		free(resize);
+		free(grown);
+		ok = false;
+	}
+
+	for (uint32_t i = STRIPES; i-- > 0;) {
+		pthread_mutex_unlock(&shared->stripes[i].lock);
+	}
+	pthread_mutex_unlock(&shared->resize_lock);
+
+	return ok;
+}
+
+// slot holding key, caller holds the key's stripe lock
+static hash_slot_t *shared_find_locked(hashtable_t * table, const char *key,
+				       uint32_t hashed)
+{
+	struct hash_shared_t *shared = table->shared;
+	hash_slot_t *slot = shared_find(atomic_load(&shared->current), key,
+					hashed);
+
+	if (!slot) {
+		hash_resize_t *resize = atomic_load(&shared->resize);
+		if (resize) {
+			slot = shared_find(resize->from, key, hashed);
+		}
+	}
+
+	return slot;
+}
+
+static bool shared_insert(hashtable_t * table, const char *key, void *data)
+{
+	uint32_t hashed = table_hash(table, key, strlen(key));
+	stripe_t *stripe = key_stripe(table, hashed);
+
+	while (true) {
+		shared_migrate(table);
+
+		pthread_mutex_lock(&stripe->lock);
+
+		hash_slot_t *slot = shared_find_locked(table, key, hashed);
+		if (slot) {
+			void *old = __atomic_load_n(&slot->data,
+						    __ATOMIC_RELAXED);
+
+			seq_begin(stripe);
+			__atomic_store_n(&slot->data, data, __ATOMIC_RELAXED);
+			seq_end(stripe);
+			pthread_mutex_unlock(&stripe->lock);
+
+			if (old && old != data && table->destroy) {
+				retire(table, NULL, NULL, NULL, old);
+			}
+			return true;
+		}
+
+		if (!shared_needs_grow(table)) {
+			break;
+		}
+		// never hold a stripe while resizing or helping a resize
+		pthread_mutex_unlock(&stripe->lock);
+
+		if (!shared_start_resize(table)) {
+			return false;
+		}
+	}
+
+	char *new_key = strdup(key);
+	bool placed = new_key
+	    && shared_place(table, atomic_load(&table->shared->current),
+			    hashed, new_key, data);
+	if (placed) {
+		__atomic_fetch_add(&table->count, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (!placed) {
+		perror("hashtable insert");
+		errno = 0;
+		free(new_key);
+	}
+
+	return placed;
+}
+
+static bool shared_remove(hashtable_t * table, const char *key)
+{
+	struct hash_shared_t *shared = table->shared;
+	uint32_t hashed = table_hash(table, key, strlen(key));
+	stripe_t *stripe = key_stripe(table, hashed);
+
+	pthread_mutex_lock(&stripe->lock);
+
+	hash_slot_t *slot = shared_find_locked(table, key, hashed);
+	if (!slot) {
+		pthread_mutex_unlock(&stripe->lock);
+		return false;
+	}
+
+	char *old_key = __atomic_load_n(&slot->key.ptr, __ATOMIC_RELAXED);
+	void *old_data = __atomic_load_n(&slot->data, __ATOMIC_RELAXED);
+	hash_array_t *current = atomic_load(&shared->current);
+
+	seq_begin(stripe);
+	shared_vacate(slot);
+	seq_end(stripe);
+
+	__atomic_fetch_sub(&table->count, 1, __ATOMIC_RELAXED);
+	if (slot >= current->slots && slot < current->slots + current->load) {
+		__atomic_fetch_add(&table->tombstones, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&stripe->lock);
+
+	retire(table, NULL, NULL, old_key, old_data);
+
+	return true;
+}
+
+static void *shared_lookup(hashtable_t * table, const char *key)
+{
+	struct hash_shared_t *shared = table->shared;
+	uint32_t hashed = table_hash(table, key, strlen(key));
+	stripe_t *stripe = key_stripe(table, hashed);
+	void *data;
+	unsigned int seq;
+
+	do {
+		seq = atomic_load_explicit(&stripe->seq, memory_order_acquire);
+		if (seq & 1) {
+			// a writer of this stripe is mid update
+			continue;
+		}
+
+		hash_array_t *current = atomic_load(&shared->current);
+		hash_resize_t *resize = atomic_load(&shared->resize);
+
+		hash_slot_t *slot = shared_find(current, key, hashed);
+		if (!slot && resize) {
+			slot = shared_find(resize->from, key, hashed);
+		}
+		data = slot ? __atomic_load_n(&slot->data, __ATOMIC_RELAXED) :
+		    NULL;
+
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1)
+		 || seq != atomic_load_explicit(&stripe->seq,
+						memory_order_relaxed));
+
+	return data;
+}
+
+static void shared_display(hashtable_t * table, user_print_func display)
+{
+	hash_resize_t *resize = atomic_load(&table->shared->resize);
+
+	display_array(atomic_load(&table->shared->current), display);
+	if (resize) {
+		printf("\n----- RESIZING -----\n\n");
+		display_array(resize->from, display);
+	}
+}
+
+// slot holding key in either array, and which array that is
+static hash_slot_t *table_find(hashtable_t * table, const char *key,
+			       size_t len, uint32_t hashed,
+			       hash_array_t ** array)
+{
+	// while resizing, a key not moved yet is still in the old array
+	*array = &table->current;
+	hash_slot_t *slot = array_find(table, *array, key, len, hashed);
+
+	if (!slot) {
+		*array = &table->old;
+		slot = array_find(table, *array, key, len, hashed);
+	}
+
+	return slot;
+}
+
+// slot for key, a new one holding NULL data if the key is not in the table
+static hash_slot_t *upsert_slot(hashtable_t * table, const char *key,
+				bool *inserted)
+{
+	size_t len = strlen(key);
+	uint32_t hashed = table_hash(table, key, len);
+	hash_array_t *array;
+
+	hash_slot_t *slot = table_find(table, key, len, hashed, &array);
+	if (slot) {
+		*inserted = false;
+		return slot;
+	}
+
+	migrate_slots(table, MIGRATE_BATCH);
+
+	if ((needs_grow(table) || (!table->old.slots && keys_bloated(table)))
+	    && !start_resize(table)) {
+		return NULL;
+	}
+
+	hash_slot_t entry = {.hash = hashed };
+	if (!slot_store_key(&table->keys, &table->key_bytes, &entry, key,
+			    len)) {
+		perror("hashtable key arena");
+		errno = 0;
+		return NULL;
+	}
+
+	slot = array_place(table, &table->current, &entry);
+
+	++table->count;
+	*inserted = true;
+	return slot;
+}
+
+bool hashtable_insert(hashtable_t * table, const char *key, void *data)
+{
+	if (!table || !key) {
+		return false;
+	}
+
+	if (table->shared) {
+		return shared_insert(table, key, data);
+	}
+	if (table->image) {
+		return false;
+	}
+
+	bool inserted;
+	hash_slot_t *slot = upsert_slot(table, key, &inserted);
+	if (!slot) {
+		return false;
+	}
+	// an update releases the value it replaces
+	if (!inserted && table->destroy && slot->data && slot->data != data) {
+		table->destroy(slot->data);
+	}
+	slot->data = data;
+
+	return true;
+}
+
+void **hashtable_get_or_insert(hashtable_t * table, const char *key,
+			       bool *inserted)
+{
+	// slots move between arrays under other threads' feet, and snapshots
+	// are read-only
+	if (!table || !key || table->shared || table->image) {
+		return NULL;
+	}
+
+	bool created;
+	hash_slot_t *slot = upsert_slot(table, key, &created);
+	if (!slot) {
+		return NULL;
+	}
+
+	if (inserted) {
+		*inserted = created;
+	}
+
+	return &slot->data;
+}
+
+bool hashtable_remove(hashtable_t * table, const char *key)
+{
+	if (!table || !key) {
+		return false;
+	}
+
+	if (table->shared) {
+		return shared_remove(table, key);
+	}
+	if (table->image) {
+		return false;
+	}
+
+	migrate_slots(table, MIGRATE_BATCH);
+
+	size_t len = strlen(key);
+	hash_array_t *array;
+	hash_slot_t *slot = table_find(table, key, len,
+				       table_hash(table, key, len), &array);
+	if (!slot) {
+		return false;
+	}
+
+	if (table->destroy && slot->data) {
+		table->destroy(slot->data);
+	}
+	slot_drop_key(table, slot);
+
+	array_erase(table, array, slot);
+	--table->count;
+
+	return true;
+}
+
+void *hashtable_lookup(hashtable_t * table, const char *key)
+{
+	if (!table || !key) {
+		return NULL;
+	}
+
+	if (table->shared) {
+		return shared_lookup(table, key);
+	}
+
+	size_t len = strlen(key);
+	uint32_t hashed = table_hash(table, key, len);
+	if (table->image) {
+		return image_lookup(table, key, len, hashed);
+	}
+
+	hash_array_t *array;
+	hash_slot_t *slot = table_find(table, key, len, hashed, &array);
+
+	return slot ? slot->data : NULL;
+}
+
+// first cache line a lookup of hashed reads, the swiss engine's control group
+static void prefetch_home(const hashtable_t * table, uint32_t hashed)
+{
+	const hash_array_t *array = &table->current;
+
+	if (table->image) {
+		image_prefetch(table, hashed);
+	} else if (HASHTABLE_SWISS == table->engine) {
+		uint32_t group = hash_group(hashed, array->load);
+		__builtin_prefetch(array->ctrl + group * GROUP_SIZE);
+	} else {
+		__builtin_prefetch(&array->slots[hash_home(hashed,
+							  array->load)]);
+	}
+}
+
+// the slot a lookup of hashed compares first: the home slot, or for the swiss
+// engine the first tag match in the home group. NULL if there is none
+static const hash_slot_t *first_candidate(const hashtable_t * table,
+					  uint32_t hashed)
+{
+	const hash_array_t *array = &table->current;
+
+	if (HASHTABLE_SWISS != table->engine) {
+		return &array->slots[hash_home(hashed, array->load)];
+	}
+
+	uint32_t group = hash_group(hashed, array->load);
+	uint32_t mask = group_match(array->ctrl + group * GROUP_SIZE,
+				    hash_h2(hashed));
+
+	return mask ? &array->slots[group * GROUP_SIZE + __builtin_ctz(mask)] :
+	    NULL;
+}
+
+// an arena key is one more miss behind its slot
+static void prefetch_key(const hash_slot_t * slot, uint32_t hashed)
+{
+	if (SLOT_FULL == slot->state && hashed == slot->hash
+	    && HASH_KEY_EXTERN == slot->key_len) {
+		__builtin_prefetch(slot->key.ptr);
+	}
+}
+
+/*
+ * A single lookup spends most of its time waiting on memory: for its home
+ * slot, for the swiss engine the slot a tag matched, then for an arena key.
+ * The next lookup cannot start until then. Here keys go in batches, and each
+ * of those steps is taken for the whole batch before the next one: hash and
+ * prefetch every home slot, prefetch every first candidate slot (swiss), then
+ * every candidate's key, and only then probe. The misses of a batch overlap
+ * instead of queueing up behind each other. Meanwhile the key strings of the
+ * next batch are prefetched for hashing.
+ */
+size_t hashtable_lookup_many(hashtable_t * table, const char *const *keys,
+			     size_t n, void **out)
+{
+	if (!table || (!keys && n) || (!out && n)) {
+		return 0;
+	}
+
+	size_t found = 0;
+
+	// lock-free lookups validate per key, nothing to batch
+	if (table->shared) {
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = keys[i] ? shared_lookup(table, keys[i]) : NULL;
+			found += NULL != out[i];
+		}
+		return found;
+	}
+
+	bool swiss = HASHTABLE_SWISS == table->engine && !table->image;
+
+	for (size_t first = 0; first < n; first += LOOKUP_BATCH) {
+		size_t batch = n - first < LOOKUP_BATCH ? n - first :
+		    LOOKUP_BATCH;
+		const char *const *key = keys + first;
+		size_t lens[LOOKUP_BATCH];
+		uint32_t hashes[LOOKUP_BATCH];
+
+		// the next batch's key strings arrive while this one probes
+		for (size_t i = first + batch; i < n && i < first + 2 * batch;
+		     ++i) {
+			__builtin_prefetch(keys[i]);
+		}
+
+		for (size_t i = 0; i < batch; ++i) {
+			if (!key[i]) {
+				continue;
+			}
+			lens[i] = strlen(key[i]);
+			hashes[i] = table_hash(table, key[i], lens[i]);
+			prefetch_home(table, hashes[i]);
+		}
+
+		const hash_slot_t *candidates[LOOKUP_BATCH];
+		for (size_t i = 0; !table->image && i < batch; ++i) {
+			candidates[i] = key[i] ?
+			    first_candidate(table, hashes[i]) : NULL;
+			if (swiss && candidates[i]) {
+				__builtin_prefetch(candidates[i]);
+			}
+		}
+
+		for (size_t i = 0; !table->image && i < batch; ++i) {
+			if (candidates[i]) {
+				prefetch_key(candidates[i], hashes[i]);
+			}
+		}
+
+		for (size_t i = 0; i < batch; ++i) {
+			void *data = NULL;
+
+			if (!key[i]) {
+				// no key, no data
+			} else if (table->image) {
+				data = image_lookup(table, key[i], lens[i],
+						    hashes[i]);
+			} else {
+				hash_array_t *array;
+				hash_slot_t *slot = table_find(table, key[i],
+							       lens[i],
+							       hashes[i],
+							       &array);
+				data = slot ? slot->data : NULL;
+			}
+
+			out[first + i] = data;
+			found += NULL != data;
+		}
+	}
+
+	return found;
+}
+
+void hashtable_display(hashtable_t * table)
+{
+	if (!table) {
+		return;
+	}
+
+	user_print_func display = table->print;
+
+	printf("\n----- HASH TABLE -----\n\n");
+	display_array(&table->current, display);
+	if (table->shared) {
+		shared_display(table, display);
+	}
+	if (table->image) {
+		image_display(table, display);
+	}
+
+	if (table->old.slots) {
+		printf("\n----- RESIZING -----\n\n");
+		display_array(&table->old, display);
+	}
+	printf("\n--------- END ---------\n");
+
+}
+
+/*
+ * Data parallel helpers for bulk builds and parallel walks: the work is cut
+ * into parts up front, one thread runs each. The threads are created for the
+ * call and joined before it returns rather than taken from a pool, which
+ * keeps this directory free of a dependency on thread_pool/. Creating a
+ * thread costs tens of microseconds, next to parts of at least
+ * BUILD_MIN_PART keys or WALK_MIN_PART slots each.
+ */
+
+// runs func on each of num_parts parts, which are size bytes apart. part 0
+// runs on the calling thread
+static void run_parallel(void *parts, size_t size, int num_parts,
+			 void *(*func)(void *))
+{
+	pthread_t threads[MAX_PARTS];
+	bool started[MAX_PARTS] = { false };
+	char *part = parts;
+
+	for (int i = 1; i < num_parts; ++i) {
+		started[i] = 0 == pthread_create(&threads[i], NULL, func,
+						 part + i * size);
+	}
+
+	// a thread that could not be started runs here instead
+	func(part);
+	for (int i = 1; i < num_parts; ++i) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		} else {
+			func(part + i * size);
+		}
+	}
+}
+
+// parts worth running for n items of work: at least min_part items each,
+// one per cpu, and no more than limit if that is positive
+static int parallel_parts(size_t n, size_t min_part, int limit)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t parts = n / min_part;
+
+	if (limit > 0 && parts > (size_t)limit) {
+		parts = limit;
+	} else if (limit <= 0 && cpus > 0 && parts > (size_t)cpus) {
+		parts = cpus;
+	}
+	if (parts > MAX_PARTS) {
+		parts = MAX_PARTS;
+	}
+
+	return parts ? parts : 1;
+}
+
+/*
+ * Bulk build. The slot array is sized for all n keys up front and cut into
+ * one contiguous range per thread. Every thread hashes its share of the keys,
+ * then walks all hashes and places the keys whose home slot lies in its own
+ * range, so no two threads ever touch the same slot. A key whose probe would
+ * leave the range is set aside and inserted afterwards on the calling thread,
+ * which keeps the layout exactly what serial inserts could have produced.
+ * So does a repeated key, so that the last of its values wins. Each thread
+ * stores long keys in its own arena, the table adopts them all.
+ */
+typedef struct build_part_t {
+	hashtable_t *table;
+	const char *const *keys;
+	void *const *values;
+	uint32_t *hashes;
+	size_t n;
+	// keys hashed by this part
+	size_t first;
+	size_t last;
+	// slots, or for the swiss engine groups, this part places keys in
+	uint32_t lo;
+	uint32_t hi;
+	key_arena_t arena;
+	size_t key_bytes;
+	uint32_t placed;
+	// keys left for the serial pass, in input order
+	size_t *deferred;
+	size_t num_deferred;
+	bool failed;
+} build_part_t;
+
+static void build_defer(build_part_t * part, size_t i)
+{
+	// at most every key is deferred, the array is sized for that
+	part->deferred[part->num_deferred++] = i;
+}
+
+static void build_store(build_part_t * part, hash_slot_t * slot, size_t i,
+			size_t len)
+{
+	if (!slot_store_key(&part->arena, &part->key_bytes, slot,
+			    part->keys[i], len)) {
+		part->failed = true;
+		return;
+	}
+
+	slot->hash = part->hashes[i];
+	slot->data = part->values ? part->values[i] : NULL;
+	slot->state = SLOT_FULL;
+	++part->placed;
+}
+
+static void build_linear(build_part_t * part, size_t i)
+{
+	hash_array_t *array = &part->table->current;
+	uint32_t hashed = part->hashes[i];
+	size_t len = strlen(part->keys[i]);
+
+	for (uint32_t index = hash_home(hashed, array->load); index < part->hi;
+	     ++index) {
+		hash_slot_t *slot = &array->slots[index];
+
+		if (SLOT_FULL != slot->state) {
+			build_store(part, slot, i, len);
+			return;
+		}
+		if (hashed == slot->hash
+		    && slot_has_key(slot, part->keys[i], len)) {
+			build_defer(part, i);
+			return;
+		}
+	}
+
+	build_defer(part, i);
+}
+
+// only the home group is tried, anything further along the probe sequence
+// may belong to another part
+static void build_swiss(build_part_t * part, size_t i)
+{
+	hash_array_t *array = &part->table->current;
+	uint32_t hashed = part->hashes[i];
+	size_t len = strlen(part->keys[i]);
+	uint32_t group = hash_group(hashed, array->load);
+	uint8_t *ctrl = array->ctrl + group * GROUP_SIZE;
+
+	for (uint32_t mask = group_match(ctrl, hash_h2(hashed)); mask;
+	     mask &= mask - 1) {
+		hash_slot_t *slot = &array->slots[group * GROUP_SIZE +
+						   __builtin_ctz(mask)];
+
+		if (hashed == slot->hash
+		    && slot_has_key(slot, part->keys[i], len)) {
+			build_defer(part, i);
+			return;
+		}
+	}
+
+	uint32_t mask = group_match_free(ctrl);
+	if (!mask) {
+		build_defer(part, i);
+		return;
+	}
+
+	uint32_t index = group * GROUP_SIZE + __builtin_ctz(mask);
+	array->ctrl[index] = hash_h2(hashed);
+	build_store(part, &array->slots[index], i, len);
+}
+
+static void *build_hash_part(void *arg)
+{
+	build_part_t *part = arg;
+
+	for (size_t i = part->first; i < part->last; ++i) {
+		part->hashes[i] = table_hash(part->table, part->keys[i],
+					     strlen(part->keys[i]));
+	}
+
+	return NULL;
+}
+
+static void *build_place_part(void *arg)
+{
+	build_part_t *part = arg;
+	hash_array_t *array = &part->table->current;
+	bool swiss = HASHTABLE_SWISS == part->table->engine;
+
+	for (size_t i = 0; i < part->n && !part->failed; ++i) {
+		uint32_t hashed = part->hashes[i];
+		uint32_t home = swiss ? hash_group(hashed, array->load) :
+		    hash_home(hashed, array->load);
+
+		if (home < part->lo || home >= part->hi) {
+			continue;
+		}
+
+		if (swiss) {
+			build_swiss(part, i);
+		} else {
+			build_linear(part, i);
+		}
+	}
+
+	return NULL;
+}
+
+// first array size that holds n entries below the table's load limit
+static uint32_t build_load(const hashtable_t * table, size_t n)
+{
+	uint32_t load = HASHTABLE_SWISS == table->engine ? GROUP_SIZE :
+	    LOAD_FACTOR;
+
+	while ((uint64_t)n + 1 > max_fill(table, load) && load < (1u << 31)) {
+		load *= 2;
+	}
+
+	return load;
+}
+
+static bool build_parallel(hashtable_t * table, const char *const *keys,
+			   void *const *values, size_t n)
+{
+	int num_parts = parallel_parts(n, BUILD_MIN_PART, 0);
+	build_part_t parts[MAX_PARTS];
+	uint32_t *hashes = malloc(n * sizeof(uint32_t));
+	uint32_t ranges = HASHTABLE_SWISS == table->engine ?
+	    table->current.load / GROUP_SIZE : table->current.load;
+	bool ok = hashes;
+
+	for (int i = 0; i < num_parts; ++i) {
+		build_part_t *part = &parts[i];
+
+		memset(part, 0, sizeof(*part));
+		part->table = table;
+		part->keys = keys;
+		part->values = values;
+		part->hashes = hashes;
+		part->n = n;
+		part->first = n * i / num_parts;
+		part->last = n * (i + 1) / num_parts;
+		part->lo = (uint64_t)ranges * i / num_parts;
+		part->hi = (uint64_t)ranges * (i + 1) / num_parts;
+		part->deferred = malloc(n * sizeof(size_t));
+		ok = ok && part->deferred;
+	}
+
+	if (ok) {
+		run_parallel(parts, sizeof(*parts), num_parts,
+			     build_hash_part);
+		run_parallel(parts, sizeof(*parts), num_parts,
+			     build_place_part);
+	}
+
+	for (int i = 0; i < num_parts; ++i) {
+		build_part_t *part = &parts[i];
+
+		ok = ok && !part->failed;
+		table->count += part->placed;
+		table->key_bytes += part->key_bytes;
+		arena_adopt(&table->keys, &part->arena);
+	}
+
+	// the leftovers go in serially, in input order within each part, and
+	// a repeated key always lands in the same part
+	for (int i = 0; ok && i < num_parts; ++i) {
+		for (size_t j = 0; ok && j < parts[i].num_deferred; ++j) {
+			size_t k = parts[i].deferred[j];
+			ok = hashtable_insert(table, keys[k],
+					      values ? values[k] : NULL);
+		}
+	}
+
+	for (int i = 0; i < num_parts; ++i) {
+		free(parts[i].deferred);
+	}
+	free(hashes);
+
+	return ok;
+}
+
+static int compare_ptr(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t) * (void *const *)a;
+	uintptr_t y = (uintptr_t) * (void *const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Releases every value a later one for the same key replaced, each once
+ * however often it was given. A value that some key still holds, e.g. one
+ * shared between keys, stays. scratch has room for 2 * n pointers: the
+ * replaced values, then the values the table ended up with.
+ */
+static void build_release_replaced(hashtable_t * table,
+				   const char *const *keys,
+				   void *const *values, size_t n,
+				   void **scratch)
+{
+	void **replaced = scratch;
+	void **kept = scratch + n;
+	size_t num_replaced = 0;
+	size_t num_kept = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		void *final = hashtable_lookup(table, keys[i]);
+
+		if (values[i] && final != values[i]) {
+			replaced[num_replaced++] = values[i];
+		}
+		if (final) {
+			kept[num_kept++] = final;
+		}
+	}
+
+	qsort(replaced, num_replaced, sizeof(void *), compare_ptr);
+	qsort(kept, num_kept, sizeof(void *), compare_ptr);
+
+	// both sorted, one merge pass finds the replaced values still held
+	size_t k = 0;
+	for (size_t i = 0; i < num_replaced; ++i) {
+		if (i && replaced[i] == replaced[i - 1]) {
+			continue;
+		}
+		while (k < num_kept && compare_ptr(&kept[k], &replaced[i]) < 0) {
+			++k;
+		}
+		if (k == num_kept || kept[k] != replaced[i]) {
+			table->destroy(replaced[i]);
+		}
+	}
+}
+
+hashtable_t *hashtable_build_from(const char *const *keys,
+				  void *const *values, size_t n,
+				  user_print_func print,
+				  user_free_func destroy,
+				  const hashtable_options_t * options)
+{
+	if (!keys && n) {
+		return NULL;
+	}
+
+	hashtable_t *table = create_table_opts(print, destroy, options);
+	if (!table) {
+		return NULL;
+	}
+
+	// the values stay the caller's until the whole build has succeeded, so
+	// repeated keys must not release the values they replace on the way
+	void **scratch = NULL;
+	if (destroy && values) {
+		scratch = malloc((n ? 2 * n : 1) * sizeof(void *));
+	}
+	bool ok = scratch || !destroy || !values;
+	table->destroy = NULL;
+
+	if (ok && table->shared) {
+		// concurrent tables fill up through their own insert path
+		for (size_t i = 0; ok && i < n; ++i) {
+			ok = hashtable_insert(table, keys[i],
+					      values ? values[i] : NULL);
+		}
+	} else if (ok) {
+		hash_array_t presized;
+		ok = array_alloc(&presized, table->engine,
+				 build_load(table, n));
+		if (ok) {
+			array_free(&table->current);
+			table->current = presized;
+			ok = build_parallel(table, keys, values, n);
+		}
+	}
+
+	if (!ok) {
+		perror("hashtable build");
+		errno = 0;
+		hashtable_destroy(&table);
+	} else {
+		table->destroy = destroy;
+		if (scratch) {
+			build_release_replaced(table, keys, values, n,
+					       scratch);
+		}
+	}
+
+	free(scratch);
+	return table;
+}
+
+/*
+ * Snapshots. hashtable_save() writes a file that is usable exactly as it lies
+ * on disk: a header, a linear probing slot array and the keys and values,
+ * all referenced by file offset rather than by pointer, so the file can be
+ * mapped at any address. hashtable_load() maps it read-only, checks the
+ * header and the slots' offsets and is done. Lookups probe the mapping
+ * directly, and the kernel pages in the keys and values only as they touch
+ * them.
+ */
+typedef struct image_header_t {
+	uint64_t magic;
+	// file size
+	uint64_t size;
+	// slot count, a power of two
+	uint32_t load;
+	uint32_t count;
+	// the saving table's hash of IMAGE_MAGIC, catches loading with a
+	// different hash function
+	uint32_t hash_check;
+	uint32_t reserved;
+	// the caller's stamp of what the table was built from
+	uint64_t stamp;
+} image_header_t;
+
+typedef struct image_slot_t {
+	uint32_t hash;
+	uint32_t key_len;
+	// offsets of the NUL terminated key, 0 for an empty slot, and of the
+	// value, 0 for NULL
+	uint64_t key;
+	uint64_t data;
+	uint64_t size;
+} image_slot_t;
+
+struct hash_image_t {
+	const char *base;
+	size_t size;
+	const image_slot_t *slots;
+	uint32_t load;
+};
+
+static uint32_t image_hash_check(const hashtable_t * table)
+{
+	uint64_t magic = IMAGE_MAGIC;
+	return table->hash(&magic, sizeof(magic));
+}
+
+// the slot arrays holding table's entries
+static int table_arrays(hashtable_t * table, hash_array_t * arrays[2])
+{
+	if (table->shared) {
+		hash_resize_t *resize = atomic_load(&table->shared->resize);
+
+		arrays[0] = atomic_load(&table->shared->current);
+		arrays[1] = resize ? resize->from : NULL;
+		return resize ? 2 : 1;
+	}
+
+	arrays[0] = &table->current;
+	arrays[1] = &table->old;
+	return 2;
+}
+
+// pads the file out to the next multiple of IMAGE_ALIGN
+static uint64_t image_align(FILE * fp, uint64_t offset)
+{
+	while (offset % IMAGE_ALIGN) {
+		fputc(0, fp);
+		++offset;
+	}
+	return offset;
+}
+
+// writes the value of data, returns its offset or 0 on failure
+static uint64_t image_write_data(FILE * fp, uint64_t * offset,
+				 user_save_func save, const void *data,
+				 uint64_t * size)
+{
+	char small[256];
+	char *buf = small;
+	size_t bytes = save(data, buf, sizeof(small));
+
+	if (bytes > sizeof(small)) {
+		buf = malloc(bytes);
+		if (!buf) {
+			return 0;
+		}
+		bytes = save(data, buf, bytes);
+	}
+
+	*offset = image_align(fp, *offset);
+	uint64_t start = *offset;
+	fwrite(buf, 1, bytes, fp);
+	*offset += bytes;
+	*size = bytes;
+
+	if (buf != small) {
+		free(buf);
+	}
+	return start;
+}
+
+bool hashtable_save(hashtable_t * table, const char *path,
+		    user_save_func save, uint64_t stamp)
+{
+	if (!table || !path || table->image) {
+		return false;
+	}
+
+	// written next to path and renamed over it once complete, so path
+	// never holds half a snapshot
+	size_t path_len = strlen(path);
+	char *tmp_path = malloc(path_len + sizeof(".XXXXXX"));
+	if (!tmp_path) {
+		perror("hashtable save");
+		errno = 0;
+		return false;
+	}
+	memcpy(tmp_path, path, path_len);
+	memcpy(tmp_path + path_len, ".XXXXXX", sizeof(".XXXXXX"));
+
+	uint32_t load = IMAGE_MIN_LOAD;
+	while ((uint64_t)table->count + 1 > (uint64_t)(load * MAX_LOAD)) {
+		load *= 2;
+	}
+
+	image_slot_t *slots = calloc(load, sizeof(image_slot_t));
+	int fd = slots ? mkstemp(tmp_path) : -1;
+	FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!fp) {
+		perror("hashtable save");
+		errno = 0;
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		free(slots);
+		free(tmp_path);
+		return false;
+	}
+
+	uint64_t offset = IMAGE_SLOTS + (uint64_t)load * sizeof(image_slot_t);
+	bool ok = 0 == fseek(fp, offset, SEEK_SET);
+	uint32_t count = 0;
+
+	hash_array_t *arrays[2];
+	int num_arrays = table_arrays(table, arrays);
+	for (int a = 0; ok && a < num_arrays; ++a) {
+		for (uint32_t i = 0; ok && i < arrays[a]->load; ++i) {
+			const hash_slot_t *slot = &arrays[a]->slots[i];
+			if (SLOT_FULL != slot->state) {
+				continue;
+			}
+
+			uint32_t index = hash_home(slot->hash, load);
+			while (slots[index].key) {
+				index = (index + 1) & (load - 1);
+			}
+
+			image_slot_t *out = &slots[index];
+			const char *key = slot_key(slot);
+			out->hash = slot->hash;
+			out->key_len = strlen(key);
+			out->key = offset;
+			fwrite(key, 1, out->key_len + 1, fp);
+			offset += out->key_len + 1;
+
+			if (save && slot->data) {
+				out->data = image_write_data(fp, &offset, save,
+							     slot->data,
+							     &out->size);
+				ok = out->data;
+			}
+			++count;
+		}
+	}
+
+	image_header_t header = {
+		.magic = IMAGE_MAGIC,.size = offset,.load = load,.count =
+		    count,.hash_check = image_hash_check(table),.stamp = stamp
+	};
+	ok = ok && 0 == fseek(fp, 0, SEEK_SET)
+	    && 1 == fwrite(&header, sizeof(header), 1, fp)
+	    && 0 == fseek(fp, IMAGE_SLOTS, SEEK_SET)
+	    && load == fwrite(slots, sizeof(image_slot_t), load, fp)
+	    && !ferror(fp);
+	ok = 0 == fclose(fp) && ok;
+	ok = ok && 0 == rename(tmp_path, path);
+	free(slots);
+
+	if (!ok) {
+		perror("hashtable save");
+		errno = 0;
+		unlink(tmp_path);
+	}
+
+	free(tmp_path);
+	return ok;
+}
+
+// a slot's key, NUL included, and value lie past the slot array and inside
+// the file
+static bool image_slot_valid(const struct hash_image_t *image,
+			     const image_slot_t * slot, uint64_t first)
+{
+	if (slot->key < first || slot->key >= image->size
+	    || slot->key_len >= image->size - slot->key
+	    || image->base[slot->key + slot->key_len]) {
+		return false;
+	}
+
+	return !slot->data || (slot->data >= first
+			       && !(slot->data % IMAGE_ALIGN)
+			       && slot->data <= image->size
+			       && slot->size <= image->size - slot->data);
+}
+
+/*
+ * Everything a lookup follows is checked once here, so a truncated or
+ * corrupted file is refused rather than read out of bounds: the header, then
+ * every full slot's offsets, and that the full slots number exactly count,
+ * which leaves the empty slot every probe stops at. It reads the slot array
+ * and the byte after each key, the keys and values themselves stay unread.
+ */
+static bool image_valid(const struct hash_image_t *image,
+			const hashtable_t * table)
+{
+	if (image->size < IMAGE_SLOTS) {
+		return false;
+	}
+
+	const image_header_t *header = (const image_header_t *)image->base;
+
+	if (IMAGE_MAGIC != header->magic || image->size != header->size
+	    || !header->load || (header->load & (header->load - 1))
+	    || header->count >= header->load
+	    || (image->size - IMAGE_SLOTS) / sizeof(image_slot_t) <
+	    header->load || image_hash_check(table) != header->hash_check) {
+		return false;
+	}
+
+	uint64_t first = IMAGE_SLOTS + (uint64_t)header->load *
+	    sizeof(image_slot_t);
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < header->load; ++i) {
+		const image_slot_t *slot = &image->slots[i];
+
+		if (!slot->key) {
+			continue;
+		}
+		if (!image_slot_valid(image, slot, first)) {
+			return false;
+		}
+		++count;
+	}
+	return count == header->count;
+}
+
+hashtable_t *hashtable_load(const char *path, user_print_func print,
+			    const hashtable_options_t * options, uint64_t stamp)
+{
+	if (!path || (options && options->concurrent)) {
+		return NULL;
+	}
+
+	// a missing file is for the caller to handle, errno tells why
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	void *base = MAP_FAILED;
+	if (0 == fstat(fd, &st) && st.st_size > 0) {
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (MAP_FAILED == base) {
+		return NULL;
+	}
+
+	struct hash_image_t *image = malloc(sizeof(struct hash_image_t));
+	hashtable_t *table = calloc(1, sizeof(hashtable_t));
+	if (!image || !table
+	    || 0 != pthread_mutex_init(&table->table_lock, NULL)) {
+		perror("hashtable load");
+		errno = 0;
+		free(image);
+		free(table);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	table->engine = HASHTABLE_LINEAR;
+	table->print = print;
+	table->hash = options && options->hash ? options->hash : hash_crc32c;
+
+	*image = (struct hash_image_t) {
+	.base = base,.size = st.st_size,.slots =
+		    (const image_slot_t *)((const char *)base + IMAGE_SLOTS)};
+	table->image = image;
+
+	if (!image_valid(image, table)) {
+		hashtable_destroy(&table);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	const image_header_t *header = base;
+	if (stamp != header->stamp) {
+		hashtable_destroy(&table);
+		errno = ESTALE;
+		return NULL;
+	}
+
+	image->load = header->load;
+	table->count = header->count;
+
+	return table;
+}
+
+static void image_destroy(hashtable_t * table)
+{
+	if (!table->image) {
+		return;
+	}
+
+	munmap((void *)table->image->base, table->image->size);
+	free(table->image);
+	table->image = NULL;
+}
+
+static void *image_lookup(hashtable_t * table, const char *key, size_t len,
+			  uint32_t hashed)
+{
+	const struct hash_image_t *image = table->image;
+	uint32_t mask = image->load - 1;
+
+	// count < load, so there is always an empty slot to stop at
+	for (uint32_t index = hash_home(hashed, image->load);;
+	     index = (index + 1) & mask) {
+		const image_slot_t *slot = &image->slots[index];
+
+		if (!slot->key) {
+			return NULL;
+		}
+		if (hashed == slot->hash && len == slot->key_len
+		    && !memcmp(image->base + slot->key, key, len)) {
+			return slot->data ? (void *)(image->base + slot->data) :
+			    NULL;
+		}
+	}
+}
+
+static void image_prefetch(const hashtable_t * table, uint32_t hashed)
+{
+	const struct hash_image_t *image = table->image;
+
+	__builtin_prefetch(&image->slots[hash_home(hashed, image->load)]);
+}
+
+static void image_display(hashtable_t * table, user_print_func display)
+{
+	const struct hash_image_t *image = table->image;
+
+	for (uint32_t i = 0; i < image->load; ++i) {
+		const image_slot_t *slot = &image->slots[i];
+
+		printf("[%d]: ", i);
+		if (slot->key && display) {
+			display(slot->data ? (void *)(image->base + slot->data)
+				: NULL);
+		} else {
+			puts("");
+		}
+	}
+}
+
+/*
+ * Iteration. Every entry has a position in one index space that runs through
+ * the current slot array and then the old one (or through a snapshot's
+ * slots), so a cursor is just a position, and a range of positions is a
+ * share of the table for one thread of a parallel walk. Entries come in slot
+ * order, which stays the same as long as the table is not modified.
+ */
+
+// slots in the index space
+static uint64_t walk_size(hashtable_t * table)
+{
+	if (table->image) {
+		return table->image->load;
+	}
+
+	hash_array_t *arrays[2];
+	int num_arrays = table_arrays(table, arrays);
+	uint64_t size = 0;
+
+	for (int a = 0; a < num_arrays; ++a) {
+		size += arrays[a]->load;
+	}
+	return size;
+}
+
+// the first entry at or after *pos and before end, moving *pos past it
+static bool walk_next(hashtable_t * table, uint64_t * pos, uint64_t end,
+		      const char **key, void **data)
+{
+	if (table->image) {
+		const struct hash_image_t *image = table->image;
+
+		while (*pos < end && *pos < image->load) {
+			const image_slot_t *slot = &image->slots[(*pos)++];
+			if (slot->key) {
+				*key = image->base + slot->key;
+				*data = slot->data ?
+				    (void *)(image->base + slot->data) : NULL;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	hash_array_t *arrays[2];
+	int num_arrays = table_arrays(table, arrays);
+	uint64_t first = 0;
+
+	for (int a = 0; a < num_arrays; ++a) {
+		const hash_array_t *array = arrays[a];
+
+		while (*pos < end && *pos < first + array->load) {
+			const hash_slot_t *slot = &array->slots[*pos - first];
+
+			++*pos;
+			if (SLOT_FULL == slot->state) {
+				*key = slot_key(slot);
+				*data = slot->data;
+				return true;
+			}
+		}
+		first += array->load;
+	}
+
+	return false;
+}
+
+bool hashtable_next(hashtable_t * table, hashtable_cursor_t * cursor,
+		    const char **key, void **data)
+{
+	if (!table || !cursor) {
+		return false;
+	}
+
+	const char *next_key;
+	void *next_data;
+	if (!walk_next(table, &cursor->pos, UINT64_MAX, &next_key,
+		       &next_data)) {
+		return false;
+	}
+
+	if (key) {
+		*key = next_key;
+	}
+	if (data) {
+		*data = next_data;
+	}
+	return true;
+}
+
+bool hashtable_foreach(hashtable_t * table, user_visit_func visit, void *arg)
+{
+	if (!table || !visit) {
+		return false;
+	}
+
+	uint64_t pos = 0;
+	const char *key;
+	void *data;
+
+	while (walk_next(table, &pos, UINT64_MAX, &key, &data)) {
+		if (!visit(key, data, arg)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+typedef struct walk_part_t {
+	hashtable_t *table;
+	user_visit_func visit;
+	void *arg;
+	uint64_t lo;
+	uint64_t hi;
+	// set by the first visit that asks to stop, seen by every part
+	atomic_bool *stop;
+} walk_part_t;
+
+static void *walk_part(void *arg)
+{
+	walk_part_t *part = arg;
+	uint64_t pos = part->lo;
+	const char *key;
+	void *data;
+
+	while (!atomic_load_explicit(part->stop, memory_order_relaxed)
+	       && walk_next(part->table, &pos, part->hi, &key, &data)) {
+		if (!part->visit(key, data, part->arg)) {
+			atomic_store(part->stop, true);
+		}
+	}
+
+	return NULL;
+}
+
+bool hashtable_foreach_parallel(hashtable_t * table, user_visit_func visit,
+				void *arg, int threads)
+{
+	if (!table || !visit) {
+		return false;
+	}
+
+	uint64_t size = walk_size(table);
+	int num_parts = parallel_parts(size, WALK_MIN_PART, threads);
+	walk_part_t parts[MAX_PARTS];
+	atomic_bool stop = false;
+
+	for (int i = 0; i < num_parts; ++i) {
+		parts[i].table = table;
+		parts[i].visit = visit;
+		parts[i].arg = arg;
+		parts[i].lo = size * i / num_parts;
+		parts[i].hi = size * (i + 1) / num_parts;
+		parts[i].stop = &stop;
+	}
+
+	run_parallel(parts, sizeof(*parts), num_parts, walk_part);
+
+	return !atomic_load(&stop);
+}
+
+/*
+ * Statistics. Probe lengths are recomputed from each entry's hash and where
+ * it sits, as the number of slots (linear) or groups (swiss) a lookup of it
+ * inspects.
+ */
+static uint32_t probe_length(const hashtable_t * table,
+			     const hash_array_t * array, uint32_t index)
+{
+	uint32_t hashed = array->slots[index].hash;
+
+	if (HASHTABLE_SWISS != table->engine) {
+		uint32_t home = hash_home(hashed, array->load);
+		return ((index - home) & (array->load - 1)) + 1;
+	}
+
+	uint32_t group_mask = array->load / GROUP_SIZE - 1;
+	uint32_t group = hash_group(hashed, array->load);
+	uint32_t probes = 1;
+
+	for (uint32_t step = 1; group != index / GROUP_SIZE; ++step) {
+		group = (group + step) & group_mask;
+		++probes;
+	}
+	return probes;
+}
+
+static void stats_probe(hashtable_stats_t * stats, uint32_t probes,
+			uint64_t * total)
+{
+	uint32_t bucket = probes - 1 < HASHTABLE_PROBE_BUCKETS ?
+	    probes - 1 : HASHTABLE_PROBE_BUCKETS - 1;
+
+	++stats->probe_hist[bucket];
+	*total += probes;
+	if (probes > stats->max_probe) {
+		stats->max_probe = probes;
+	}
+}
+
+bool hashtable_stats(hashtable_t * table, hashtable_stats_t * stats)
+{
+	if (!table || !stats) {
+		return false;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	stats->count = table->count;
+	stats->arena_bytes = table->keys.used + table->old_keys.used;
+	stats->key_bytes = table->key_bytes;
+
+	uint64_t total = 0;
+	uint64_t entries = 0;
+
+	if (table->image) {
+		const struct hash_image_t *image = table->image;
+		uint32_t mask = image->load - 1;
+
+		stats->capacity = image->load;
+		for (uint32_t i = 0; i < image->load; ++i) {
+			if (image->slots[i].key) {
+				uint32_t home = hash_home(image->slots[i].hash,
+							  image->load);
+				stats_probe(stats, ((i - home) & mask) + 1,
+					    &total);
+				++entries;
+			}
+		}
+	} else {
+		hash_array_t *arrays[2];
+		int num_arrays = table_arrays(table, arrays);
+
+		for (int a = 0; a < num_arrays; ++a) {
+			const hash_array_t *array = arrays[a];
+
+			stats->capacity += array->load;
+			for (uint32_t i = 0; i < array->load; ++i) {
+				uint32_t state = array->slots[i].state;
+
+				if (SLOT_DELETED == state) {
+					++stats->tombstones;
+				} else if (SLOT_FULL == state) {
+					stats_probe(stats,
+						    probe_length(table, array,
+								 i), &total);
+					++entries;
+				}
+			}
+		}
+	}
+
+	uint64_t load = table->image ? table->image->load :
+	    table->shared ? atomic_load(&table->shared->current)->load :
+	    table->current.load;
+	stats->load_factor = load ? (double)stats->count / load : 0;
+	stats->avg_probe = entries ? (double)total / entries : 0;
+
+	return true;
+}
+
+/*
+ * CRC-32C (Castagnoli). x86-64 cpus with SSE4.2 compute it with the crc32
+ * instruction, 8 bytes at a time. Everything else runs slice-by-8: eight
+ * lookup tables let one step fold in 8 bytes with independent loads instead
+ * of a serial chain of 8 byte lookups. The tables and the implementation are
+ * picked once, on first use. The IEEE CRC-32 of hash_crc32() has no
+ * instruction and always runs slice-by-8, over tables of its own polynomial.
+ */
+#define CRC32C_POLY 0x82F63B78
+#define CRC32_POLY 0xEDB88320
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32_table[8][256];
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t * data,
+			       size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t load_u64(const uint8_t * data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+// the 8 bytes at data as a little endian word, whatever the cpu's byte order
+static inline uint64_t load_le64(const uint8_t * data)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap64(load_u64(data));
+#else
+	return load_u64(data);
+#endif
+}
+
+static uint32_t crc_slice8(uint32_t table[8][256], uint32_t crc,
+			   const uint8_t * data, size_t len)
+{
+	// the lowest byte of each word is the first one in data
+	for (; len >= 8; len -= 8, data += 8) {
+		uint64_t word = load_le64(data) ^ crc;
+
+		crc = table[7][word & 0xFF] ^
+		    table[6][(word >> 8) & 0xFF] ^
+		    table[5][(word >> 16) & 0xFF] ^
+		    table[4][(word >> 24) & 0xFF] ^
+		    table[3][(word >> 32) & 0xFF] ^
+		    table[2][(word >> 40) & 0xFF] ^
+		    table[1][(word >> 48) & 0xFF] ^ table[0][word >> 56];
+	}
+
+	while (len--) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t * data, size_t len)
+{
+	return crc_slice8(crc32c_table, crc, data, len);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t * data, size_t len)
+{
+	uint64_t crc64 = crc;
+
+	for (; len >= 8; len -= 8, data += 8) {
+		crc64 = __builtin_ia32_crc32di(crc64, load_u64(data));
+	}
+	crc = (uint32_t) crc64;
+
+	while (len--) {
+		crc = __builtin_ia32_crc32qi(crc, *data++);
+	}
+
+	return crc;
+}
+#endif
+
+static void crc_fill_tables(uint32_t table[8][256], uint32_t poly)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (poly & (0 - (crc & 1)));
+		}
+		table[0][i] = crc;
+	}
+
+	// table k advances a byte through k more zero bytes
+	for (uint32_t i = 0; i < 256; ++i) {
+		for (int k = 1; k < 8; ++k) {
+			uint32_t prev = table[k - 1][i];
+			table[k][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+		}
+	}
+}
+
+static void crc_init(void)
+{
+	crc_fill_tables(crc32c_table, CRC32C_POLY);
+	crc_fill_tables(crc32_table, CRC32_POLY);
+
+	crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_impl = crc32c_hw;
+	}
+#endif
+}
+
+/**
+ * @brief calculates the CRC-32C of len bytes, in hardware where available.
+ *
+ * @param data
+ * @param len
+ * @return uint32_t
+ */
+uint32_t hash_crc32c(const void *data, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+
+	return crc32c_impl(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
+}
+
+/**
+ * @brief calculates the CRC-32 (IEEE 802.3, as in zlib) of a nul terminated
+ * string.
+ *
+ * @param str
+ * @return uint32_t
+ */
+uint32_t hash_crc32(const char *str)
+{
+	pthread_once(&crc_once, crc_init);
+
+	return crc_slice8(crc32_table, 0xFFFFFFFF, (const uint8_t *)str,
+			  strlen(str)) ^ 0xFFFFFFFF;
+}
+
+/*
+ * wyhash, final version 4, by Wang Yi (public domain,
+ * https://github.com/wangyi-fudan/wyhash). Reads 16 to 48 bytes per round
+ * through 64x64->128 bit multiplies, much faster than any CRC without
+ * hardware support, and still of good quality for table indexing.
+ */
+__extension__ typedef unsigned __int128 wy_u128;
+
+static const uint64_t wy_secret[4] = {
+	0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+	0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+static inline void wy_mum(uint64_t * a, uint64_t * b)
+{
+	wy_u128 r = (wy_u128) * a * *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+	wy_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t wy_r4(const uint8_t * p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t wy_r3(const uint8_t * p, size_t k)
+{
+	return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+/**
+ * @brief calculates the 64 bit wyhash of len bytes.
+ *
+ * @param data
+ * @param len
+ * @param seed
+ * @return uint64_t
+ */
+uint64_t hash_wyhash(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = data;
+	uint64_t a;
+	uint64_t b;
+
+	seed ^= wy_mix(seed ^ wy_secret[0], wy_secret[1]);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+			b = (wy_r4(p + len - 4) << 32) |
+			    wy_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = wy_r3(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i >= 48) {
+			uint64_t see1 = seed;
+			uint64_t see2 = seed;
+
+			do {
+				seed = wy_mix(load_u64(p) ^ wy_secret[1],
+					      load_u64(p + 8) ^ seed);
+				see1 = wy_mix(load_u64(p + 16) ^ wy_secret[2],
+					      load_u64(p + 24) ^ see1);
+				see2 = wy_mix(load_u64(p + 32) ^ wy_secret[3],
+					      load_u64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i >= 48);
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16) {
+			seed = wy_mix(load_u64(p) ^ wy_secret[1],
+				      load_u64(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = load_u64(p + i - 16);
+		b = load_u64(p + i - 8);
+	}
+
+	a ^= wy_secret[1];
+	b ^= seed;
+	wy_mum(&a, &b);
+
+	return wy_mix(a ^ wy_secret[0] ^ len, b ^ wy_secret[1]);
+}
+
+/**
+ * @brief wyhash folded to 32 bits, usable as a table's hash function.
+ *
+ * @param data
+ * @param len
+ * @return uint32_t
+ */
+uint32_t hash_wyhash32(const void *data, size_t len)
+{
+	uint64_t hashed = hash_wyhash(data, len, 0);
+
+	return (uint32_t) (hashed ^ (hashed >> 32));
+}
@@ -9,36 +9,239 @@
 
 typedef void (*user_print_func)(void *);
 typedef void (*user_free_func)(void *);
+typedef uint32_t(*user_hash_func) (const void *, size_t);
+// writes what hashtable_save() stores for data into buf, which holds size
+// bytes, and returns how many bytes that takes. it is called again with a
+// large enough buf if that is more than size
+typedef size_t (*user_save_func)(const void *data, void *buf, size_t size);
+// called for each entry of a walk, returns false to end it
+typedef bool (*user_visit_func)(const char *key, void *data, void *arg);
 
-typedef struct hash_node_t {
-	char *key;
+enum slot_state {
+	SLOT_EMPTY,
+	SLOT_FULL,
+	SLOT_DELETED,
+	// concurrent mode: taken by a writer that is still filling it in
+	SLOT_CLAIMED
+};
+
+// longest key stored in the slot itself instead of the key arena
+#define HASH_INLINE_KEY 15
+// key_len of a slot whose key lives out of line
+#define HASH_KEY_EXTERN UINT16_MAX
+
+// one open addressing slot, stored inline in the table's slot array. the
+// cached hash lets most probes reject a slot without touching the key, and
+// short keys need no pointer chase at all
+typedef struct hash_slot_t {
+	uint32_t hash;
+	uint16_t state;
+	// length of an inline key, HASH_KEY_EXTERN if key.ptr is used
+	uint16_t key_len;
 	void *data;
-	bool deleted;
+	union {
+		char *ptr;
+		char bytes[HASH_INLINE_KEY + 1];
+	} key;
 
-} hash_node_t;
+} hash_slot_t;
 
-typedef struct hashtable_t {
+// probing scheme used by a table, chosen at creation
+typedef enum hashtable_engine_t {
+	// linear probing over the slot array, grows at 75% load
+	HASHTABLE_LINEAR,
+	// swiss table: a parallel array of 7-bit hash tags probed 16 slots at a
+	// time with SIMD compares, grows at 87.5% load
+	HASHTABLE_SWISS
+} hashtable_engine_t;
+
+typedef struct hashtable_options_t {
+	hashtable_engine_t engine;
+	// key hash, NULL for hash_crc32c. hash_wyhash32 is faster on cpus
+	// without SSE4.2
+	user_hash_func hash;
+	// safe to insert, remove and look up from many threads at once, linear
+	// engine only. see hashtable_reclaim()
+	bool concurrent;
+
+} hashtable_options_t;
+
+// one generation of slots, a table holds two of them while it is resizing
+typedef struct hash_array_t {
 	uint32_t load;
+	hash_slot_t *slots;
+	// swiss engine only, one control byte per slot
+	uint8_t *ctrl;
+
+} hash_array_t;
+
+// bump allocator for keys too long to inline. removed keys stay in it
+// until a resize compacts it
+typedef struct key_arena_t {
+	// newest chunk first
+	struct key_chunk_t *chunks;
+	// bytes handed out, live or not
+	size_t used;
+
+} key_arena_t;
+
+// probe lengths counted exactly up to this, longer ones share the last bucket
+#define HASHTABLE_PROBE_BUCKETS 16
+
+// shape of a table, from hashtable_stats()
+typedef struct hashtable_stats_t {
+	uint32_t count;
+	// slots in the current array, and the old one while resizing
+	uint64_t capacity;
+	// count over the current array's slots
+	double load_factor;
+	// deleted slots still in the arrays
+	uint64_t tombstones;
+	// slots (groups for the swiss engine) a lookup of each present key
+	// looks at, 1 if it sits in its home slot
+	double avg_probe;
+	uint32_t max_probe;
+	// probe_hist[i] keys take i + 1 probes
+	uint64_t probe_hist[HASHTABLE_PROBE_BUCKETS];
+	// key arena bytes handed out, and how many still belong to a key
+	size_t arena_bytes;
+	size_t key_bytes;
+
+} hashtable_stats_t;
+
+// position of a walk over a table with hashtable_next(), start it zeroed.
+// valid as long as the table is not modified
+typedef struct hashtable_cursor_t {
+	uint64_t pos;
+
+} hashtable_cursor_t;
+
+typedef struct hashtable_t {
 	uint32_t count;
-	hash_node_t **buckets;
+	hash_array_t current;
+	// the array being migrated out of during a resize, empty otherwise.
+	// slots below migrated have already moved to current
+	hash_array_t old;
+	uint32_t migrated;
+	// swiss engine only, deleted slots in current that still count as used
+	uint32_t tombstones;
+	key_arena_t keys;
+	// the arena being compacted out of during a resize, empty otherwise
+	key_arena_t old_keys;
+	// arena bytes still referenced by a slot
+	size_t key_bytes;
+	hashtable_engine_t engine;
+	// concurrent mode state, NULL otherwise
+	struct hash_shared_t *shared;
+	// the mapped snapshot of a table opened with hashtable_load()
+	struct hash_image_t *image;
 	pthread_mutex_t table_lock;
 	user_print_func print;
 	user_free_func destroy;
+	user_hash_func hash;
 
 } hashtable_t;
 
+// CRC-32 (IEEE, the one zlib computes) of a nul terminated string
 uint32_t hash_crc32(const char *str);
 
+// CRC-32C, uses the SSE4.2 crc32 instruction when the cpu has it
+uint32_t hash_crc32c(const void *data, size_t len);
+
+uint64_t hash_wyhash(const void *data, size_t len, uint64_t seed);
+
+uint32_t hash_wyhash32(const void *data, size_t len);
+
 hashtable_t *create_table(user_print_func print, user_free_func destroy);
 
+// options may be NULL, which behaves like create_table()
+hashtable_t *create_table_opts(user_print_func print, user_free_func destroy,
+			       const hashtable_options_t * options);
+
+// table mapping keys[i] to values[i] (values may be NULL), presized for n
+// keys and filled in parallel, one thread per cpu, created for the call
+// rather than taken from a thread pool. a repeated key keeps its last value,
+// the ones it replaces go to destroy, each once, after the build has
+// succeeded. a replaced value that another key still holds is kept. NULL on
+// failure, with none of the values released
+hashtable_t *hashtable_build_from(const char *const *keys,
+				  void *const *values, size_t n,
+				  user_print_func print,
+				  user_free_func destroy,
+				  const hashtable_options_t * options);
+
 void hashtable_destroy(hashtable_t ** table);
 
+// writes table to path as a snapshot for hashtable_load(), with whatever save
+// writes for each value (no values if save is NULL). stamp identifies the
+// data the table was built from, e.g. a hash of its source file's size and
+// mtime. the snapshot is written to a temporary file next to path and
+// renamed over it, so path is never left half written
+bool hashtable_save(hashtable_t * table, const char *path,
+		    user_save_func save, uint64_t stamp);
+
+// maps a snapshot from hashtable_save() read-only and looks keys up in it in
+// place, with no parsing. lookups return pointers into the mapping. the
+// options' hash must be the one the snapshot was saved with. inserts and
+// removes fail, hashtable_destroy() unmaps it. NULL with errno set if path
+// cannot be opened, EINVAL if it is not a snapshot or any of its slots
+// points outside the file, ESTALE if it was saved with a stamp other than
+// stamp
+hashtable_t *hashtable_load(const char *path, user_print_func print,
+			    const hashtable_options_t * options, uint64_t stamp);
+
+// adds key, or replaces its data (released with destroy) if it is present
 bool hashtable_insert(hashtable_t * table, const char *key, void *data);
 
+// pointer to the data stored for key, adding key with NULL data if it is not
+// present. inserted (may be NULL) tells which happened. the pointer is only
+// valid until the next insert or remove. not available in concurrent mode,
+// where it returns NULL
+void **hashtable_get_or_insert(hashtable_t * table, const char *key,
+			       bool *inserted);
+
+// removes key and releases its data with destroy, false if it was not present
+bool hashtable_remove(hashtable_t * table, const char *key);
+
+// concurrent mode keeps removed keys, replaced or removed data and retired
+// slot arrays alive, since a lock-free lookup may still be reading them.
+// call this at a point where no other thread is inside a hashtable call to
+// release them, data goes to destroy. a no-op for other tables
+void hashtable_reclaim(hashtable_t * table);
+
 void hashtable_display(hashtable_t * table);
 
 void * hashtable_lookup(hashtable_t * table, const char *data);
 
+// looks up all n keys, out[i] gets the data for keys[i] (NULL if absent or
+// if keys[i] is NULL). much faster than n hashtable_lookup() calls on tables
+// larger than the cache, since the memory latency of the lookups overlaps.
+// returns how many of out are not NULL
+size_t hashtable_lookup_many(hashtable_t * table, const char *const *keys,
+			     size_t n, void **out);
+
+// walks the table one entry per call, in slot order. key and data (either may
+// be NULL) get the entry, false once there are no more. inserts and removes
+// invalidate the cursor, keys stay valid until then
+bool hashtable_next(hashtable_t * table, hashtable_cursor_t * cursor,
+		    const char **key, void **data);
+
+// calls visit with every entry, in slot order, until it returns false.
+// returns whether every entry was visited
+bool hashtable_foreach(hashtable_t * table, user_visit_func visit, void *arg);
+
+// like hashtable_foreach(), but the slots are split between threads (threads
+// of them, or one per cpu if that is 0), which call visit concurrently and
+// in no particular order. the threads are started for the call and joined
+// before it returns, there is no pool to hand in. once a visit returns false,
+// the others stop soon after. the table must not be modified meanwhile
+bool hashtable_foreach_parallel(hashtable_t * table, user_visit_func visit,
+				void *arg, int threads);
+
+// fills in stats by scanning every slot, false for a NULL table or stats. a
+// concurrent table must not be written to meanwhile
+bool hashtable_stats(hashtable_t * table, hashtable_stats_t * stats);
+
 #endif				/* HASHTABLE_H */
 
 /* end of file */
@@ -0,0 +1,295 @@
+/** @file hashtable_test.c
+*
+* @brief hashtable_test.c tests public functions from hashtable.h
+*
+* COPYRIGHT NOTICE: (c) 2023 Jacob Hitchcox
+*
+*/
+
+#include "../src/hashtable.h"
+#include <check.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_VALUES 8
+
+// the snapshot layout: slots start after the header block, and each slot is
+// a hash and key length, then the key, value and value size offsets
+#define SNAPSHOT_PATH "hashtable_test.snap"
+#define SNAPSHOT_SLOTS 64
+#define SNAPSHOT_SLOT_SIZE 32
+#define SNAPSHOT_KEY 8
+#define SNAPSHOT_DATA 16
+#define SNAPSHOT_SIZE 24
+
+static int values[NUM_VALUES];
+static int released[NUM_VALUES];
+
+static void release_value(void *data)
+{
+	released[(int *)data - values]++;
+}
+
+static void print_value(void *data)
+{
+	printf("%d\n", *(int *)data);
+}
+
+static size_t save_value(const void *data, void *buf, size_t size)
+{
+	if (size >= sizeof(int)) {
+		memcpy(buf, data, sizeof(int));
+	}
+	return sizeof(int);
+}
+
+static void reset_released(void)
+{
+	for (int i = 0; i < NUM_VALUES; i++) {
+		released[i] = 0;
+	}
+}
+
+static const hashtable_options_t engines[] = {
+	{.engine = HASHTABLE_LINEAR},
+	{.engine = HASHTABLE_SWISS},
+	{.engine = HASHTABLE_LINEAR,.concurrent = true},
+};
+
+START_TEST(test_basic_ops)
+{
+	for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+		hashtable_t *table = create_table_opts(print_value,
+						       release_value,
+						       &engines[e]);
+		ck_assert(table != NULL);
+		reset_released();
+
+		ck_assert(hashtable_insert(table, "one", &values[1]));
+		ck_assert(hashtable_insert(table, "two", &values[2]));
+		ck_assert(hashtable_lookup(table, "one") == &values[1]);
+		ck_assert(hashtable_lookup(table, "three") == NULL);
+
+		// an update releases the value it replaces
+		ck_assert(hashtable_insert(table, "one", &values[3]));
+		ck_assert(hashtable_lookup(table, "one") == &values[3]);
+		hashtable_reclaim(table);
+		ck_assert(released[1] == 1);
+
+		ck_assert(hashtable_remove(table, "two"));
+		ck_assert(!hashtable_remove(table, "two"));
+		ck_assert(hashtable_lookup(table, "two") == NULL);
+
+		hashtable_destroy(&table);
+		ck_assert(table == NULL);
+		ck_assert(released[2] == 1);
+		ck_assert(released[3] == 1);
+	}
+}
+
+END_TEST START_TEST(test_crc_vectors)
+{
+	// long enough to go through the word at a time loops
+	const char *fox = "The quick brown fox jumps over the lazy dog";
+
+	ck_assert(hash_crc32("123456789") == 0xCBF43926);
+	ck_assert(hash_crc32(fox) == 0x414FA339);
+	ck_assert(hash_crc32c("123456789", 9) == 0xE3069283);
+	ck_assert(hash_crc32c(fox, strlen(fox)) == 0x22620404);
+}
+
+END_TEST START_TEST(test_build_from_replaced)
+{
+	// "a" gets values[0] twice before values[1] replaces it
+	const char *keys[] = { "a", "b", "a", "a" };
+	void *data[] = { &values[0], &values[2], &values[0], &values[1] };
+
+	for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+		reset_released();
+		hashtable_t *table = hashtable_build_from(keys, data, 4,
+							  print_value,
+							  release_value,
+							  &engines[e]);
+		ck_assert(table != NULL);
+		ck_assert(hashtable_lookup(table, "a") == &values[1]);
+		ck_assert(hashtable_lookup(table, "b") == &values[2]);
+		ck_assert(released[0] == 1);
+		ck_assert(released[1] == 0);
+		ck_assert(released[2] == 0);
+
+		hashtable_destroy(&table);
+		ck_assert(released[0] == 1);
+		ck_assert(released[1] == 1);
+		ck_assert(released[2] == 1);
+	}
+}
+
+END_TEST START_TEST(test_build_from_shared)
+{
+	// values[0] is replaced for "a" but is still what "b" holds
+	const char *keys[] = { "a", "b", "a", "c", "c" };
+	void *data[] = { &values[0], &values[0], &values[1], &values[1],
+		&values[2]
+	};
+
+	for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+		reset_released();
+		hashtable_t *table = hashtable_build_from(keys, data, 5,
+							  print_value,
+							  release_value,
+							  &engines[e]);
+		ck_assert(table != NULL);
+		ck_assert(hashtable_lookup(table, "a") == &values[1]);
+		ck_assert(hashtable_lookup(table, "b") == &values[0]);
+		ck_assert(hashtable_lookup(table, "c") == &values[2]);
+		for (int i = 0; i < NUM_VALUES; i++) {
+			ck_assert(released[i] == 0);
+		}
+
+		// the table hands the shared values to destroy once per key
+		ck_assert(hashtable_remove(table, "b"));
+		hashtable_destroy(&table);
+		ck_assert(released[0] == 1);
+		ck_assert(released[1] == 1);
+		ck_assert(released[2] == 1);
+	}
+}
+
+END_TEST START_TEST(test_lookup_during_resize)
+{
+	char keys[256][16];
+
+	// the concurrent engine migrates on its own schedule
+	for (size_t e = 0; e < 2; e++) {
+		hashtable_t *table = create_table_opts(print_value, NULL,
+						       &engines[e]);
+		int n = 0;
+
+		// insert until a resize is in flight
+		while (!table->old.slots) {
+			ck_assert(n < 256);
+			snprintf(keys[n], sizeof(keys[n]), "k%d", n);
+			ck_assert(hashtable_insert(table, keys[n],
+						   &values[n % NUM_VALUES]));
+			n++;
+		}
+
+		// lookups find keys in both arrays but move none of them
+		uint32_t migrated = table->migrated;
+		const char *many[256];
+		void *out[256];
+		for (int i = 0; i < n; i++) {
+			ck_assert(hashtable_lookup(table, keys[i]) ==
+				  &values[i % NUM_VALUES]);
+			many[i] = keys[i];
+		}
+		ck_assert(hashtable_lookup_many(table, many, n, out) ==
+			  (size_t)n);
+		ck_assert(table->old.slots != NULL);
+		ck_assert(table->migrated == migrated);
+
+		hashtable_destroy(&table);
+	}
+}
+
+END_TEST
+/*
+ * Saves a table of one key, then overwrites the 64 bit field at field in its
+ * slot with value, and returns what hashtable_load() makes of the file
+ */
+static hashtable_t *load_corrupted(size_t field, uint64_t value)
+{
+	hashtable_t *table = create_table(print_value, NULL);
+	ck_assert(hashtable_insert(table, "key", &values[5]));
+	ck_assert(hashtable_save(table, SNAPSHOT_PATH, save_value, 1));
+	hashtable_destroy(&table);
+
+	FILE *fp = fopen(SNAPSHOT_PATH, "r+b");
+	ck_assert(fp != NULL);
+
+	// the only full slot
+	long slot = SNAPSHOT_SLOTS;
+	uint64_t key = 0;
+	for (;; slot += SNAPSHOT_SLOT_SIZE) {
+		ck_assert(0 == fseek(fp, slot + SNAPSHOT_KEY, SEEK_SET));
+		ck_assert(1 == fread(&key, sizeof(key), 1, fp));
+		if (key) {
+			break;
+		}
+	}
+
+	ck_assert(0 == fseek(fp, slot + field, SEEK_SET));
+	ck_assert(1 == fwrite(&value, sizeof(value), 1, fp));
+	ck_assert(0 == fclose(fp));
+
+	errno = 0;
+	table = hashtable_load(SNAPSHOT_PATH, print_value, NULL, 1);
+	unlink(SNAPSHOT_PATH);
+	return table;
+}
+
+START_TEST(test_snapshot_bounds)
+{
+	hashtable_t *table = create_table(print_value, NULL);
+	ck_assert(hashtable_insert(table, "key", &values[5]));
+	values[5] = 5;
+	ck_assert(hashtable_save(table, SNAPSHOT_PATH, save_value, 1));
+	hashtable_destroy(&table);
+
+	table = hashtable_load(SNAPSHOT_PATH, print_value, NULL, 1);
+	unlink(SNAPSHOT_PATH);
+	ck_assert(table != NULL);
+	ck_assert(*(int *)hashtable_lookup(table, "key") == 5);
+	hashtable_destroy(&table);
+
+	// a key, or a value, past the end of the file
+	ck_assert(load_corrupted(SNAPSHOT_KEY, UINT64_MAX - 1) == NULL);
+	ck_assert(errno == EINVAL);
+	ck_assert(load_corrupted(SNAPSHOT_DATA, 1ULL << 40) == NULL);
+	ck_assert(errno == EINVAL);
+	ck_assert(load_corrupted(SNAPSHOT_SIZE, UINT64_MAX) == NULL);
+	ck_assert(errno == EINVAL);
+
+	// a key inside the slot array
+	ck_assert(load_corrupted(SNAPSHOT_KEY, SNAPSHOT_SLOTS) == NULL);
+	ck_assert(errno == EINVAL);
+}
+
+END_TEST Suite *hashtable_check(void)
+{
+	Suite *suite;
+	TCase *tc_core;
+
+	suite = suite_create("hashtable_tests");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, test_basic_ops);
+	tcase_add_test(tc_core, test_crc_vectors);
+	tcase_add_test(tc_core, test_build_from_replaced);
+	tcase_add_test(tc_core, test_build_from_shared);
+	tcase_add_test(tc_core, test_lookup_during_resize);
+	tcase_add_test(tc_core, test_snapshot_bounds);
+
+	suite_add_tcase(suite, tc_core);
+
+	return suite;
+}
+
+int main()
+{
+	Suite *suite = hashtable_check();
+	SRunner *runner = srunner_create(suite);
+
+	srunner_set_fork_status(runner, CK_NOFORK);
+
+	srunner_run_all(runner, CK_VERBOSE);
+
+	int no_failed = srunner_ntests_failed(runner);
+
+	srunner_free(runner);
+	return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*** end of file***/
@@ -11,6 +11,7 @@
 
 #include "kdtree_funcs.h"
 #include "file_io.h"
+#include "kdtree_flat.h"
 #include "pqueue.h"
 
 #include <string.h>
@@ -27,51 +28,11 @@ struct trunk {
 	const char *str;
 };
 
-int find_median(FILE *file)
+static void free_points(double *x_coords, double *y_coords)
 {
-	if (!file) {
-		return INT32_MIN;
-	}
-	double min = INT32_MAX;
-	double max = INT32_MIN;
-
-	long curr_location = ftell(file);
-	char buffer[1024];
-
-	while (fgets(buffer, 1023, file)) {
-		char *fields[2];
-		char *ptr = buffer;
-
-		for (int i = 0; i < 2; i++) {
-			// save the pointer to the start of the field
-			fields[i] = ptr;
-			// skip to the end of the field
-			ptr += strcspn(ptr, "\t\n");
-			if (*ptr != '\0') {
-				// set a null terminator for the field and skip to the next one
-				*ptr++ = '\0';
-			}
-		}
-
-		double res = strtod(fields[0], NULL);
-
-		if (res > max) {
-			max = res;
-		} else if (res < min) {
-			min = res;
-		}
-
-		if (0 == (int)res) {
-			printf("Invalid argument found: '%s'\n", buffer);
-			fclose(file);
-			exit(1);
-		}
-	}
-
-	fseek(file, curr_location, SEEK_SET);
-
-	return 2;
-} /* find_median() */
+	free(x_coords);
+	free(y_coords);
+}
 
 static void print_trunks(struct trunk *p)
 {
@@ -178,7 +139,7 @@ int main(int argc, char *argv[])
 			break;
 		case 'k':
 			num_neighbors = strtod(optarg, &broken);
-			if (*broken) {
+			if (*broken || num_neighbors < 1) {
 				printf("K: Invalid integer provided\n");
 				exit(1);
 			}
@@ -189,6 +150,7 @@ int main(int argc, char *argv[])
 			printf("\t-f | --file <arg>: file to input (input, by default)\n");
 			printf("\t-x | --x_coord <arg>: x-coord between -180 and 180)\n");
 			printf("\t-y | --y_coord <arg>: y-coord between -180 and 180)\n");
+			printf("\t-k | --knn <arg>: nearest points to print (1, by default)\n");
 			exit(1);
 		}
 	}
@@ -207,9 +169,17 @@ int main(int argc, char *argv[])
 	}
 
 	int line_no = 0;
-	int count = 1;
+	int count = 0;
+	int capacity = STARTING_CAP;
 	char buffer[1024];
-	tree *bst = NULL;
+	double *x_coords = malloc(capacity * sizeof(*x_coords));
+	double *y_coords = malloc(capacity * sizeof(*y_coords));
+
+	if (!x_coords || !y_coords) {
+		fclose(file);
+		free_points(x_coords, y_coords);
+		exit(1);
+	}
 
 	while (fgets(buffer, 1023, file)) {
 		char *fields[2];
@@ -234,7 +204,7 @@ int main(int argc, char *argv[])
 				printf("broken: %d\n", *broken);
 				fprintf(stderr, "%s broke me\n", buffer);
 				fclose(file);
-				tree_delete(&bst);
+				free_points(x_coords, y_coords);
 				exit(1);
 			}
 		}
@@ -244,7 +214,7 @@ int main(int argc, char *argv[])
 			printf("broken: %d\n", *broken);
 			fprintf(stderr, "%s broke me\n", buffer);
 			fclose(file);
-			tree_delete(&bst);
+			free_points(x_coords, y_coords);
 			exit(1);
 		}
 
@@ -252,48 +222,62 @@ int main(int argc, char *argv[])
 			printf("Coordinate must be between -180 and 180 "
 			       "degrees\n");
 			fclose(file);
-			tree_delete(&bst);
+			free_points(x_coords, y_coords);
 			exit(1);
 		}
 
-		if (1 == count++) {
-			bst = create_tree_node(tmp_x_coord, tmp_y_coord);
-
-			if (!bst) {
-				exit(1);
+		if (count == capacity) {
+			capacity *= 2;
+			double *tmp_x = realloc(x_coords,
+						capacity * sizeof(*x_coords));
+			if (tmp_x) {
+				x_coords = tmp_x;
+			}
+			double *tmp_y = realloc(y_coords,
+						capacity * sizeof(*y_coords));
+			if (tmp_y) {
+				y_coords = tmp_y;
 			}
-		} else {
-			int ret = kd_insert(
-				bst, create_tree_node(tmp_x_coord, tmp_y_coord),
-				0);
-			if (!ret) {
+
+			if (!tmp_x || !tmp_y) {
 				fprintf(stderr, "Unable to insert into tree\n");
 				fclose(file);
-				tree_delete(&bst);
+				free_points(x_coords, y_coords);
 				exit(1);
 			}
 		}
+
+		x_coords[count] = tmp_x_coord;
+		y_coords[count] = tmp_y_coord;
+		++count;
 	}
 
-	pqueue_t *queue = pqueue_create(100, NULL);
+	// built in one go around the medians into flat arrays, which queries
+	// read through far fewer cache lines than a tree of nodes
+	flat_tree *kd = flat_build(x_coords, y_coords, count);
+	free_points(x_coords, y_coords);
+
+	flat_neighbor *neighbors =
+		malloc(num_neighbors * sizeof(*neighbors));
 
-	if (!queue) {
+	if (!kd || !neighbors) {
+		fprintf(stderr, "Unable to build tree\n");
+		fclose(file);
+		flat_delete(&kd);
+		free(neighbors);
 		exit(1);
 	}
 
-	nearest_neighbor(bst, x_coord, y_coord, 1, 0, queue);
+	int found =
+		flat_nearest(kd, x_coord, y_coord, num_neighbors, neighbors);
 
-	for (int i = 0; i < num_neighbors; ++i) {
-		if (!pqueue_is_empty(queue)) {
-			pqueue_print(queue);
-			pqueue_extract(queue);
-		} else {
-			break;
-		}
+	for (int i = 0; i < found; ++i) {
+		printf("Distance: %lf from (%lf, %lf)\n", neighbors[i].distance,
+		       neighbors[i].x_coord, neighbors[i].y_coord);
 	}
 
 	fclose(file);
 
-	tree_delete(&bst);
-	pqueue_destroy(queue);
+	free(neighbors);
+	flat_delete(&kd);
 }
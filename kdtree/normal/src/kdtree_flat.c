@@ -0,0 +1,273 @@
+/** @file kdtree_flat.c
+*
+* @brief This module implements the functions in kdtree_flat.h
+* @par
+* COPYRIGHT NOTICE: (c) 2022 Jacob Hitchcox
+*/
+
+#include "kdtree_flat.h"
+#include "kdtree_funcs.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+struct flat_tree {
+	int count;
+	// leaf buckets, a power of two
+	int leaves;
+	// leaves - 1 split values, the axis alternates per level starting at x
+	double *split;
+	// points, bucket after bucket
+	double *x_coord;
+	double *y_coord;
+};
+
+// first point of bucket, the buckets split the points as evenly as possible
+static int bucket_start(const flat_tree * tree, int bucket)
+{
+	return (int64_t)bucket * tree->count / tree->leaves;
+}
+
+static double point_coord(void *points, int i, int axis)
+{
+	const flat_tree *tree = points;
+
+	return 0 == axis % 2 ? tree->x_coord[i] : tree->y_coord[i];
+}
+
+static void swap_points(void *points, int i, int j)
+{
+	flat_tree *tree = points;
+	double tmp = tree->x_coord[i];
+
+	tree->x_coord[i] = tree->x_coord[j];
+	tree->x_coord[j] = tmp;
+
+	tmp = tree->y_coord[i];
+	tree->y_coord[i] = tree->y_coord[j];
+	tree->y_coord[j] = tmp;
+}
+
+/*
+ * Splits the points of buckets [first, last) between the two halves of the
+ * buckets at the median of node's axis, so everything left of the split is
+ * no greater than it and everything right of it no smaller.
+ */
+static void build_node(flat_tree * tree, int node, int depth, int first,
+		       int last)
+{
+	if (last - first < 2) {
+		return;
+	}
+
+	int mid = first + (last - first) / 2;
+	int lo = bucket_start(tree, first);
+	int split = bucket_start(tree, mid);
+
+	kd_select(tree, lo, bucket_start(tree, last) - 1, split - lo, depth,
+		  point_coord, swap_points);
+	tree->split[node] = point_coord(tree, split, depth);
+
+	build_node(tree, 2 * node + 1, depth + 1, first, mid);
+	build_node(tree, 2 * node + 2, depth + 1, mid, last);
+}				/* build_node() */
+
+flat_tree *flat_build(const double *x_coords, const double *y_coords,
+		      int count)
+{
+	if ((count && (!x_coords || !y_coords)) || count < 0) {
+		return NULL;
+	}
+
+	flat_tree *tree = calloc(1, sizeof(*tree));
+
+	if (!tree) {
+		return NULL;
+	}
+
+	tree->count = count;
+	tree->leaves = 1;
+	while (count > (int64_t)tree->leaves * FLAT_BUCKET) {
+		tree->leaves *= 2;
+	}
+
+	tree->split = malloc(tree->leaves * sizeof(double));
+	tree->x_coord = malloc((count ? count : 1) * sizeof(double));
+	tree->y_coord = malloc((count ? count : 1) * sizeof(double));
+
+	if (!tree->split || !tree->x_coord || !tree->y_coord) {
+		flat_delete(&tree);
+		return NULL;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		tree->x_coord[i] = x_coords[i];
+		tree->y_coord[i] = y_coords[i];
+	}
+
+	build_node(tree, 0, 0, 0, tree->leaves);
+
+	return tree;
+}				/* flat_build() */
+
+/*
+ * The k best so far are kept as a max-heap on squared distance in the
+ * caller's neighbors array, so the one to replace is always neighbors[0].
+ */
+static void heap_sift_down(flat_neighbor * heap, int count, int position)
+{
+	for (;;) {
+		int largest = position;
+		int left = 2 * position + 1;
+		int right = left + 1;
+
+		if (left < count && heap[left].distance > heap[largest].distance) {
+			largest = left;
+		}
+		if (right < count
+		    && heap[right].distance > heap[largest].distance) {
+			largest = right;
+		}
+		if (largest == position) {
+			return;
+		}
+
+		flat_neighbor tmp = heap[position];
+		heap[position] = heap[largest];
+		heap[largest] = tmp;
+		position = largest;
+	}
+}				/* heap_sift_down() */
+
+static void heap_push(flat_neighbor * heap, int count, double x_coord,
+		      double y_coord, double distance)
+{
+	int position = count;
+
+	while (position > 0) {
+		int parent = (position - 1) / 2;
+
+		if (heap[parent].distance >= distance) {
+			break;
+		}
+		heap[position] = heap[parent];
+		position = parent;
+	}
+
+	heap[position].x_coord = x_coord;
+	heap[position].y_coord = y_coord;
+	heap[position].distance = distance;
+}				/* heap_push() */
+
+typedef struct flat_query {
+	const flat_tree *tree;
+	double val_1;
+	double val_2;
+	int k;
+	int found;
+	flat_neighbor *best;
+} flat_query;
+
+static void scan_bucket(flat_query * query, int bucket)
+{
+	const flat_tree *tree = query->tree;
+	int end = bucket_start(tree, bucket + 1);
+
+	for (int i = bucket_start(tree, bucket); i < end; ++i) {
+		double x_distance = tree->x_coord[i] - query->val_1;
+		double y_distance = tree->y_coord[i] - query->val_2;
+		double distance = x_distance * x_distance +
+		    y_distance * y_distance;
+
+		if (query->found < query->k) {
+			heap_push(query->best, query->found++,
+				  tree->x_coord[i], tree->y_coord[i], distance);
+		} else if (distance < query->best[0].distance) {
+			query->best[0].x_coord = tree->x_coord[i];
+			query->best[0].y_coord = tree->y_coord[i];
+			query->best[0].distance = distance;
+			heap_sift_down(query->best, query->found, 0);
+		}
+	}
+}				/* scan_bucket() */
+
+/*
+ * Searches the side of each split holding the query first, and the other
+ * side only if the split plane is closer than the farthest of the k best.
+ */
+static void search_node(flat_query * query, int node, int depth)
+{
+	const flat_tree *tree = query->tree;
+
+	if (node >= tree->leaves - 1) {
+		scan_bucket(query, node - (tree->leaves - 1));
+		return;
+	}
+
+	double split = (0 == depth % 2 ? query->val_1 : query->val_2) -
+	    tree->split[node];
+	int near = split < 0 ? 2 * node + 1 : 2 * node + 2;
+	int far = split < 0 ? 2 * node + 2 : 2 * node + 1;
+
+	search_node(query, near, depth + 1);
+
+	if (query->found < query->k
+	    || split * split < query->best[0].distance) {
+		search_node(query, far, depth + 1);
+	}
+}				/* search_node() */
+
+int flat_nearest(const flat_tree * tree, double val_1, double val_2, int k,
+		 flat_neighbor * neighbors)
+{
+	if (!tree || !tree->count || k <= 0 || !neighbors) {
+		return 0;
+	}
+
+	flat_query query = {
+		.tree = tree,
+		.val_1 = val_1,
+		.val_2 = val_2,
+		.k = k,
+		.best = neighbors,
+	};
+
+	search_node(&query, 0, 0);
+
+	// heap sort, each pass moves the farthest left to the end
+	for (int end = query.found - 1; end > 0; --end) {
+		flat_neighbor tmp = neighbors[0];
+		neighbors[0] = neighbors[end];
+		neighbors[end] = tmp;
+		heap_sift_down(neighbors, end, 0);
+	}
+
+	for (int i = 0; i < query.found; ++i) {
+		neighbors[i].distance = sqrt(neighbors[i].distance);
+	}
+
+	return query.found;
+}				/* flat_nearest() */
+
+int flat_size(const flat_tree * tree)
+{
+	if (!tree) {
+		return 0;
+	}
+
+	return tree->count;
+}				/* flat_size() */
+
+void flat_delete(flat_tree ** p_tree)
+{
+	if (!p_tree || !*p_tree) {
+		return;
+	}
+
+	free((*p_tree)->split);
+	free((*p_tree)->x_coord);
+	free((*p_tree)->y_coord);
+	free(*p_tree);
+	*p_tree = NULL;
+}				/* flat_delete() */
@@ -0,0 +1,60 @@
+/** @file kdtree_flat.h
+ *
+ * @brief Read-only kd-tree built once from bulk data. There are no node
+ * pointers: the splits form a complete binary tree stored in BFS order
+ * (children of i at 2i + 1 and 2i + 2), and the points sit in separate x and
+ * y arrays, grouped into leaf buckets of up to FLAT_BUCKET points that a
+ * query scans straight through
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2022 Jacob Hitchcox
+ */
+#ifndef KDTREE_FLAT_H
+#define KDTREE_FLAT_H
+
+#define FLAT_BUCKET 16
+
+typedef struct flat_tree flat_tree;
+
+typedef struct flat_neighbor {
+	double x_coord;
+	double y_coord;
+	double distance;
+} flat_neighbor;
+
+/**
+ * @brief Builds a tree holding count points, splitting on the median of
+ * alternating axes down to buckets of FLAT_BUCKET points or fewer. O(n log n)
+ *
+ * @param x_coords The x coordinates of the points, count long
+ * @param y_coords The y coordinates of the points, count long
+ * @param count Number of points
+ *
+ * @return flat_tree * On success, NULL on failure
+ */
+flat_tree *flat_build(const double *x_coords, const double *y_coords,
+		      int count);
+
+/**
+ * @brief Finds the k points closest to (val_1, val_2) with a branch and
+ * bound search
+ *
+ * @param neighbors Array of at least k, gets the points found, nearest first
+ *
+ * @return how many points were found, less than k only if the tree is
+ * smaller
+ */
+int flat_nearest(const flat_tree * tree, double val_1, double val_2, int k,
+		 flat_neighbor * neighbors);
+
+/**
+ * @brief Number of points in the tree
+ */
+int flat_size(const flat_tree * tree);
+
+/**
+ * @brief Frees the tree and sets *p_tree to NULL
+ */
+void flat_delete(flat_tree ** p_tree);
+
+#endif				/* KDTREE_FLAT_H */
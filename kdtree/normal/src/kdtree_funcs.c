@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <float.h>
+#include <string.h>
 
 #include "kdtree_funcs.h"
 #include "math.h"
@@ -79,6 +80,99 @@ int kd_insert(tree * root, tree * node, int method)
 	return 1;
 }
 
+static double point_coord(void *points, int i, int axis)
+{
+	const tree *node = ((tree **) points)[i];
+
+	return 0 == axis % 2 ? node->x_coord : node->y_coord;
+}
+
+static void swap_points(void *points, int i, int j)
+{
+	tree **nodes = points;
+	tree *tmp = nodes[i];
+
+	nodes[i] = nodes[j];
+	nodes[j] = tmp;
+}
+
+void kd_select(void *points, int lo, int hi, int k, int axis,
+	       kd_coord_func coord, kd_swap_func swap)
+{
+	k += lo;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (coord(points, mid, axis) < coord(points, lo, axis)) {
+			swap(points, lo, mid);
+		}
+		if (coord(points, hi, axis) < coord(points, lo, axis)) {
+			swap(points, lo, hi);
+		}
+		if (coord(points, hi, axis) < coord(points, mid, axis)) {
+			swap(points, mid, hi);
+		}
+
+		double pivot = coord(points, mid, axis);
+		int i = lo;
+		int j = hi;
+
+		while (i <= j) {
+			while (coord(points, i, axis) < pivot) {
+				++i;
+			}
+			while (coord(points, j, axis) > pivot) {
+				--j;
+			}
+			if (i <= j) {
+				swap(points, i++, j--);
+			}
+		}
+
+		// everything between j and i equals the pivot
+		if (k <= j) {
+			hi = j;
+		} else if (k >= i) {
+			lo = i;
+		} else {
+			return;
+		}
+	}
+}				/* kd_select() */
+
+/*
+ * Links points into a subtree split on the median of method's axis at every
+ * level. Points equal to a node on its axis may land on either side of it,
+ * which keeps runs of equal coordinates from unbalancing the tree.
+ */
+static tree *build_range(tree ** points, int n, int method, tree * parent)
+{
+	if (n <= 0) {
+		return NULL;
+	}
+
+	int mid = n / 2;
+	kd_select(points, 0, n - 1, mid, method, point_coord, swap_points);
+
+	tree *node = points[mid];
+	node->parent = parent;
+	node->left = build_range(points, mid, method + 1, node);
+	node->right = build_range(points + mid + 1, n - mid - 1, method + 1,
+				  node);
+
+	return node;
+}				/* build_range() */
+
+tree *kd_build(tree ** points, int n)
+{
+	if (!points || n <= 0) {
+		return NULL;
+	}
+
+	return build_range(points, n, 0, NULL);
+}				/* kd_build() */
+
 tree *search(tree * root, double val_1, double val_2, int method)
 {
 	if (!root) {
@@ -105,92 +199,92 @@ tree *search(tree * root, double val_1, double val_2, int method)
 	}
 }
 
-int nearest_neighbor(tree * root, double val_1, double val_2, double radius,
-		     int method, pqueue_t * list)
+static double squared_distance(const tree * node, double val_1,
+			       double val_2)
 {
-	if (!root) {
-		return 0;
-	}
+	double x_distance = (node->x_coord - val_1) * (node->x_coord - val_1);
+	double y_distance = (node->y_coord - val_2) * (node->y_coord - val_2);
 
-	double comp_distance = DBL_MAX;
-	double distance =
-	    get_distance(root->x_coord, root->y_coord, val_1, val_2);
-	root->distance = distance;
+	return x_distance + y_distance;
+}
 
-	if (distance <= radius) {
-		pqueue_insert(list, root, root->distance);
-	}
+/*
+ * Branch and bound: best is a max-heap of the k closest nodes so far (the
+ * pqueue is a min-heap, so priorities are negated squared distances), and
+ * each node's distance holds its squared distance while it is in there. The
+ * side of the split holding the query is searched first, the other side only
+ * if the split plane is closer than the farthest of the k, since nothing
+ * beyond it can get any closer than the plane.
+ */
+static void knn_search(tree * node, double val_1, double val_2, int method,
+		       pqueue_t * best)
+{
+	while (node) {
+		double distance = squared_distance(node, val_1, val_2);
 
-	if (0 == method % 2) {
-		if (val_1 < root->x_coord) {
-			if (root->right) {
-				comp_distance =
-				    get_distance(root->right->x_coord,
-						 root->right->y_coord, val_1,
-						 val_2);
-
-				if (comp_distance <= distance) {
-					root->right->distance = comp_distance;
-					pqueue_insert(list, root->right,
-						      root->right->distance);
-				}
-			}
+		if (pqueue_is_full(best)) {
+			tree *worst = pqueue_peek(best);
 
-			return nearest_neighbor(root->left, val_1, val_2,
-						radius, ++method, list);
-		} else {
-			if (root->left) {
-				comp_distance =
-				    get_distance(root->left->x_coord,
-						 root->left->y_coord, val_1,
-						 val_2);
-
-				if (comp_distance <= distance) {
-					root->left->distance = comp_distance;
-					pqueue_insert(list, root->left,
-						      root->left->distance);
-				}
+			if (distance < worst->distance) {
+				pqueue_extract(best);
+				node->distance = distance;
+				pqueue_insert(best, node, -distance);
 			}
-
-			return nearest_neighbor(root->right, val_1, val_2,
-						radius, ++method, list);
+		} else {
+			node->distance = distance;
+			pqueue_insert(best, node, -distance);
 		}
-	} else {
-		if (val_2 < root->y_coord) {
-			if (root->right) {
-				comp_distance =
-				    get_distance(root->right->x_coord,
-						 root->right->y_coord, val_1,
-						 val_2);
-
-				if (comp_distance <= distance) {
-					root->right->distance = comp_distance;
-					pqueue_insert(list, root->right,
-						      root->right->distance);
-				}
-			}
 
-			return nearest_neighbor(root->left, val_1, val_2,
-						radius, ++method, list);
-		} else {
-			if (root->left) {
-				comp_distance =
-				    get_distance(root->left->x_coord,
-						 root->left->y_coord, val_1,
-						 val_2);
-
-				if (comp_distance <= distance) {
-					root->left->distance = comp_distance;
-					pqueue_insert(list, root->left,
-						      root->left->distance);
-				}
-			}
+		double split = 0 == method % 2 ? val_1 - node->x_coord :
+		    val_2 - node->y_coord;
+		tree *near = split < 0 ? node->left : node->right;
+		tree *far = split < 0 ? node->right : node->left;
 
-			return nearest_neighbor(root->right, val_1, val_2,
-						radius, ++method, list);
+		knn_search(near, val_1, val_2, method + 1, best);
+
+		if (pqueue_is_full(best)
+		    && split * split >= ((tree *) pqueue_peek(best))->distance) {
+			return;
 		}
+
+		node = far;
+		++method;
 	}
-}
+}				/* knn_search() */
+
+int nearest_neighbor(tree * root, double val_1, double val_2, int k,
+		     tree ** neighbors)
+{
+	if (!root || k <= 0 || !neighbors) {
+		return 0;
+	}
+
+	pqueue_t *best = pqueue_create(k, NULL);
+
+	if (!best) {
+		return 0;
+	}
+
+	knn_search(root, val_1, val_2, 0, best);
+
+	// the heap gives the farthest first
+	int found = 0;
+
+	while (!pqueue_is_empty(best)) {
+		++found;
+		tree *node = pqueue_extract(best);
+		node->distance = sqrt(node->distance);
+		neighbors[k - found] = node;
+	}
+
+	if (found < k) {
+		memmove(neighbors, neighbors + k - found,
+			found * sizeof(*neighbors));
+	}
+
+	pqueue_destroy(best);
+	return found;
+}				/* nearest_neighbor() */
 
 void preorder(tree * root)
 {
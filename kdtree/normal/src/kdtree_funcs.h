@@ -18,8 +18,6 @@ tree *create_tree_node(double, double);
 
 void preorder(tree * root);
 
-int find_median(FILE * input);
-
 double get_distance(double x_val_1, double y_val_1, double x_val_2,
 		    double y_val_2);
 
@@ -31,10 +29,44 @@ void level_order(tree * root);
 
 int kd_insert(tree * root, tree * node, int method);
 
+typedef double (*kd_coord_func)(void *points, int i, int axis);
+typedef void (*kd_swap_func)(void *points, int i, int j);
+
+/**
+ * @brief Moves the k-th smallest of points lo to hi on axis (x if even, y if
+ * odd) to lo + k, with no greater ones before it and no smaller ones after it,
+ * the way nth_element does. Expected O(n), the median of three pivot keeps
+ * sorted input linear too. The points are only reached through coord and
+ * swap, so any layout of them works
+ *
+ * @param coord Returns the coordinate of point i on axis
+ * @param swap Exchanges points i and j
+ */
+void kd_select(void *points, int lo, int hi, int k, int axis,
+	       kd_coord_func coord, kd_swap_func swap);
+
+/**
+ * @brief Links n nodes from create_tree_node() into a balanced kd-tree by
+ * splitting on the median point at every level, O(n log n). The tree is
+ * log n deep whatever order the points come in. Reorders points
+ *
+ * @return root of the tree, NULL if n is 0
+ */
+tree *kd_build(tree ** points, int n);
+
 tree *search(tree *, double, double, int);
 
-int nearest_neighbor(tree * root, double val_1, double val_2, double radius,
-		     int method, pqueue_t * tree);
+/**
+ * @brief Finds the k nodes closest to (val_1, val_2) with a branch and bound
+ * search, which on a balanced tree looks at O(log n + k) nodes. Sets their
+ * distance to how far they are from it
+ *
+ * @param neighbors Array of at least k, gets the nodes found, nearest first
+ *
+ * @return how many nodes were found, less than k only if the tree is smaller
+ */
+int nearest_neighbor(tree * root, double val_1, double val_2, int k,
+		     tree ** neighbors);
 
 int bst_minimum(tree * tree);
 
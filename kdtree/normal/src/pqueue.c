@@ -113,11 +113,11 @@ static void heapify_down(int position, int size, node_t * heap)
 		return;
 	}
 
-	int swap_idx = 0;
+	int swap_idx = left_child;
 
-	if (heap[left_child].priority < heap[right_child].priority) {
-		swap_idx = left_child;
-	} else {
+	// the right child only counts if it is still in the heap
+	if (right_child < size
+	    && heap[right_child].priority < heap[left_child].priority) {
 		swap_idx = right_child;
 	}
 
@@ -150,6 +150,15 @@ void *pqueue_extract(pqueue_t * pqueue)
 	return temp;
 }				/* pqueue_extract() */
 
+void *pqueue_peek(pqueue_t * pqueue)
+{
+	if (pqueue_is_empty(pqueue)) {
+		return NULL;
+	}
+
+	return pqueue->heap[0].node_data;
+}				/* pqueue_peek() */
+
 int pqueue_is_empty(pqueue_t * pqueue)
 {
 	if (!pqueue) {
@@ -52,6 +52,14 @@ int pqueue_insert(pqueue_t * pqueue, void *item, double priority);
 */
 void *pqueue_extract(pqueue_t * pqueue);
 
+/**
+* @brief Returns the lowest value from pqueue without removing it
+*
+* @param pqueue pqueue to look at
+* @return Address of stored item or NULL on empty pqueue
+*/
+void *pqueue_peek(pqueue_t * pqueue);
+
 /**
 * @brief Used to determine if pqueue_t is empty
 *
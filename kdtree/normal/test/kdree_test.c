@@ -8,6 +8,7 @@
 
 #include "../src/file_io.h"
 #include "../src/kdtree_funcs.h"
+#include "../src/kdtree_flat.h"
 #include "../src/pqueue.h"
 #include <check.h>
 
@@ -161,6 +162,165 @@ END_TEST START_TEST(test_invalid_kdtree_ops)
 	ck_assert(tree_size(NULL) == 0);
 }
 
+END_TEST static int tree_height(tree * root)
+{
+	if (!root) {
+		return 0;
+	}
+
+	int left = tree_height(root->left);
+	int right = tree_height(root->right);
+
+	return 1 + (left > right ? left : right);
+}
+
+START_TEST(test_kd_build)
+{
+	ck_assert(kd_build(NULL, 10) == NULL);
+
+	// sorted input, which inserting one at a time turns into a list
+	int count = 1000;
+	tree **points = calloc(count, sizeof(*points));
+	tree **nodes = calloc(count, sizeof(*nodes));
+	ck_assert(points && nodes);
+
+	for (int i = 0; i < count; ++i) {
+		points[i] = create_tree_node(i * 0.1, i * -0.1);
+		nodes[i] = points[i];
+	}
+
+	tree *bst = kd_build(points, count);
+
+	ck_assert(tree_size(bst) == count);
+	ck_assert(bst->parent == NULL);
+
+	// 1000 points fit in 10 levels
+	ck_assert(tree_height(bst) == 10);
+
+	for (int i = 0; i < count; ++i) {
+		ck_assert(search(bst, nodes[i]->x_coord, nodes[i]->y_coord, 0)
+			  == nodes[i]);
+	}
+
+	tree_delete(&bst);
+
+	// every point on one spot stays balanced too
+	for (int i = 0; i < count; ++i) {
+		points[i] = create_tree_node(5, 5);
+	}
+
+	bst = kd_build(points, count);
+	ck_assert(tree_size(bst) == count);
+	ck_assert(tree_height(bst) == 10);
+
+	tree_delete(&bst);
+	free(points);
+	free(nodes);
+}
+
+END_TEST START_TEST(test_nearest_neighbor)
+{
+	// 10 x 10 grid of points one apart
+	int count = 100;
+	tree **points = calloc(count, sizeof(*points));
+	tree *neighbors[5];
+	ck_assert(points);
+
+	for (int i = 0; i < count; ++i) {
+		points[i] = create_tree_node(i / 10, i % 10);
+	}
+
+	tree *bst = kd_build(points, count);
+
+	ck_assert(nearest_neighbor(NULL, 0, 0, 5, neighbors) == 0);
+	ck_assert(nearest_neighbor(bst, 0, 0, 0, neighbors) == 0);
+
+	// the point itself, then its four direct neighbors
+	ck_assert(nearest_neighbor(bst, 4, 6, 5, neighbors) == 5);
+	ck_assert(neighbors[0]->x_coord == 4 && neighbors[0]->y_coord == 6);
+	ck_assert(neighbors[0]->distance == 0);
+	for (int i = 1; i < 5; ++i) {
+		ck_assert(neighbors[i]->distance == 1);
+	}
+
+	// nearest first, next to the edge of the split planes
+	ck_assert(nearest_neighbor(bst, 9.4, -0.2, 3, neighbors) == 3);
+	ck_assert(neighbors[0]->x_coord == 9 && neighbors[0]->y_coord == 0);
+	ck_assert(neighbors[1]->x_coord == 9 && neighbors[1]->y_coord == 1);
+	ck_assert(neighbors[2]->x_coord == 8 && neighbors[2]->y_coord == 0);
+	ck_assert(neighbors[1]->distance < neighbors[2]->distance);
+
+	tree_delete(&bst);
+
+	// fewer points than asked for
+	points[0] = create_tree_node(1, 1);
+	points[1] = create_tree_node(2, 2);
+	bst = kd_build(points, 2);
+	ck_assert(nearest_neighbor(bst, 3, 3, 5, neighbors) == 2);
+	ck_assert(neighbors[0]->x_coord == 2 && neighbors[1]->x_coord == 1);
+
+	tree_delete(&bst);
+	free(points);
+}
+
+END_TEST START_TEST(test_flat_tree)
+{
+	ck_assert(flat_build(NULL, NULL, 10) == NULL);
+
+	flat_neighbor found[8];
+	flat_tree *flat = flat_build(NULL, NULL, 0);
+
+	ck_assert(flat_size(flat) == 0);
+	ck_assert(flat_nearest(flat, 0, 0, 8, found) == 0);
+	flat_delete(&flat);
+	ck_assert(flat == NULL);
+
+	// a 10 x 10 grid takes several buckets, it has to agree with the tree
+	// of nodes wherever the query lands
+	int count = 100;
+	double x_coords[100];
+	double y_coords[100];
+	tree *points[100];
+	tree *expected[8];
+
+	for (int i = 0; i < count; ++i) {
+		x_coords[i] = i / 10;
+		y_coords[i] = (i * 7) % 10;
+		points[i] = create_tree_node(x_coords[i], y_coords[i]);
+	}
+
+	flat = flat_build(x_coords, y_coords, count);
+	tree *bst = kd_build(points, count);
+
+	ck_assert(flat_size(flat) == count);
+
+	for (double x = -1.5; x < 11; x += 0.7) {
+		for (double y = -1.5; y < 11; y += 0.9) {
+			ck_assert(flat_nearest(flat, x, y, 8, found) == 8);
+			ck_assert(nearest_neighbor(bst, x, y, 8, expected) ==
+				  8);
+
+			for (int i = 0; i < 8; ++i) {
+				ck_assert(fabs(found[i].distance -
+					       expected[i]->distance) < 1e-9);
+			}
+		}
+	}
+
+	// the query point itself comes first
+	ck_assert(flat_nearest(flat, 3, 5, 1, found) == 1);
+	ck_assert(fabs(found[0].x_coord - 3) < 1e-9);
+	ck_assert(fabs(found[0].y_coord - 5) < 1e-9);
+
+	// fewer points than asked for
+	flat_delete(&flat);
+	flat = flat_build(x_coords, y_coords, 3);
+	ck_assert(flat_nearest(flat, 0, 0, 8, found) == 3);
+
+	flat_delete(&flat);
+	tree_delete(&bst);
+}
+
 END_TEST Suite *kdtree_check(void)
 {
 	Suite *suite;
@@ -171,6 +331,9 @@ END_TEST Suite *kdtree_check(void)
 	tc_core = tcase_create("Core");
 	tcase_add_test(tc_core, test_valid_kdtree_ops);
 	tcase_add_test(tc_core, test_invalid_kdtree_ops);
+	tcase_add_test(tc_core, test_kd_build);
+	tcase_add_test(tc_core, test_nearest_neighbor);
+	tcase_add_test(tc_core, test_flat_tree);
 
 	suite_add_tcase(suite, tc_core);
 
@@ -33,52 +33,6 @@ static void *get_min(node_t * node);
 
 static int get_t_size(node_t * node);
 
-int find_median(FILE * file)
-{
-	if (!file) {
-		return INT32_MIN;
-	}
-	double min = INT32_MAX;
-	double max = INT32_MIN;
-
-	long curr_location = ftell(file);
-	char buffer[1024];
-
-	while (fgets(buffer, 1023, file)) {
-		char *fields[2];
-		char *ptr = buffer;
-
-		for (int i = 0; i < 2; i++) {
-			// save the pointer to the start of the field
-			fields[i] = ptr;
-			// skip to the end of the field
-			ptr += strcspn(ptr, "\t\n");
-			if (*ptr != '\0') {
-				// set a null terminator for the field and skip to the next one
-				*ptr++ = '\0';
-			}
-		}
-
-		double res = strtod(fields[0], NULL);
-
-		if (res > max) {
-			max = res;
-		} else if (res < min) {
-			min = res;
-		}
-
-		if (0 == (int)res) {
-			printf("Invalid argument found: '%s'\n", buffer);
-			fclose(file);
-			exit(1);
-		}
-	}
-
-	fseek(file, curr_location, SEEK_SET);
-
-	return 2;
-}				/* find_median() */
-
 tree *tree_create(compare compare_func, action action_func, destroy
 		  destroy_func)
 {
@@ -175,6 +129,132 @@ int tree_insert(tree * tree, void *data, int median)
 	return ret;
 }				/* tree_insert() */
 
+// a sorts before b on the axis of method, in the order tree_insert() uses
+static int sorts_before(tree * tree, node_t * a, node_t * b, int method)
+{
+	return 0 < tree->compare_func(a->data, b->data, method);
+}
+
+static void swap_nodes(node_t ** nodes, int i, int j)
+{
+	node_t *tmp = nodes[i];
+	nodes[i] = nodes[j];
+	nodes[j] = tmp;
+}
+
+/*
+ * Moves the k-th smallest of n nodes on the axis of method into nodes[k],
+ * with no greater ones before it and no smaller ones after it, the way
+ * nth_element does. Expected O(n), the median of three pivot keeps sorted
+ * input linear too.
+ */
+static void select_nth(tree * tree, node_t ** nodes, int n, int k, int method)
+{
+	int lo = 0;
+	int hi = n - 1;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (sorts_before(tree, nodes[mid], nodes[lo], method)) {
+			swap_nodes(nodes, lo, mid);
+		}
+		if (sorts_before(tree, nodes[hi], nodes[lo], method)) {
+			swap_nodes(nodes, lo, hi);
+		}
+		if (sorts_before(tree, nodes[hi], nodes[mid], method)) {
+			swap_nodes(nodes, mid, hi);
+		}
+
+		node_t *pivot = nodes[mid];
+		int i = lo;
+		int j = hi;
+
+		while (i <= j) {
+			while (sorts_before(tree, nodes[i], pivot, method)) {
+				++i;
+			}
+			while (sorts_before(tree, pivot, nodes[j], method)) {
+				--j;
+			}
+			if (i <= j) {
+				swap_nodes(nodes, i++, j--);
+			}
+		}
+
+		// everything between j and i equals the pivot
+		if (k <= j) {
+			hi = j;
+		} else if (k >= i) {
+			lo = i;
+		} else {
+			return;
+		}
+	}
+}				/* select_nth() */
+
+/*
+ * Links nodes into a subtree split on the median of method's axis at every
+ * level. Nodes equal to their parent on its axis may land on either side of
+ * it, which keeps runs of equal coordinates from unbalancing the tree.
+ */
+static node_t *build_range(tree * tree, node_t ** nodes, int n, int method,
+			   node_t * parent)
+{
+	if (n <= 0) {
+		return NULL;
+	}
+
+	int mid = n / 2;
+	select_nth(tree, nodes, n, mid, method);
+
+	node_t *node = nodes[mid];
+	node->parent = parent;
+	node->left = build_range(tree, nodes, mid, (method + 1) % 2, node);
+	node->right = build_range(tree, nodes + mid + 1, n - mid - 1,
+				  (method + 1) % 2, node);
+
+	return node;
+}				/* build_range() */
+
+int tree_build(tree * tree, void **data, int n)
+{
+	int ret = 0;
+	node_t **nodes = NULL;
+
+	if (!tree || tree->root || !data || n < 0) {
+		goto BUILD_EXIT;
+	}
+
+	if (!tree->compare_func) {
+		printf("Null compare function given\n");
+		goto BUILD_EXIT;
+	}
+
+	nodes = calloc(n ? n : 1, sizeof(*nodes));
+	if (!nodes) {
+		goto BUILD_EXIT;
+	}
+
+	for (int i = 0; i < n; ++i) {
+		nodes[i] = create_node(data[i]);
+
+		if (!nodes[i]) {
+			for (int j = 0; j < i; ++j) {
+				free(nodes[j]);
+			}
+			goto BUILD_EXIT;
+		}
+	}
+
+	tree->root = build_range(tree, nodes, n, 0, NULL);
+	ret = 1;
+
+ BUILD_EXIT:
+	free(nodes);
+	return ret;
+}				/* tree_build() */
+
 static void *find(node_t * node, void *value, compare compare_func, int method)
 {
 	method %= 2;
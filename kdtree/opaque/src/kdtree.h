@@ -28,8 +28,6 @@ typedef struct coordinate {
 tree *tree_create(compare compare_func, action action_func,
 		  destroy destroy_func);
 
-int find_median(FILE * input);
-
 void print_visual(tree * root);
 
 void preorder(tree * root);
@@ -55,6 +53,19 @@ void levelorder(tree * root);
  */
 int tree_insert(tree * root, void *data, int median);
 
+/**
+ * @brief Fills an empty tree with n data at once, splitting on the median
+ * of each level's axis, O(n log n). Unlike inserting one at a time, the
+ * tree ends up log n deep whatever order data comes in
+ *
+ * @param tree Empty tree to fill
+ * @param data Array of n void* to add
+ * @param n Number of elements in data
+ * @return 1 On success
+ * @return 0 On failure, with nothing added
+ */
+int tree_build(tree * tree, void **data, int n);
+
 void *tree_search(tree *, void *);
 
 void *tree_minimum(tree * tree);
@@ -20,6 +20,8 @@
 #include <float.h>
 #include <math.h>
 
+#define STARTING_CAP 20
+
 typedef double (*compare)(void *, void *, int);
 
 typedef void (*action)(void *);
@@ -103,13 +105,33 @@ int main(int argc, char *argv[])
 	FILE *file = read_file(file_name);
 
 	tree *tree = tree_create(coord_compare, coord_action, free);
-	int ret;
-	int count = 1;
+	int count = 0;
+	int capacity = STARTING_CAP;
 	char buffer[1024];
+	void **points = malloc(capacity * sizeof(*points));
+
+	if (!points) {
+		exit(1);
+	}
 
 	while (fgets(buffer, 1023, file)) {
+		if (count == capacity) {
+			capacity *= 2;
+			void **grown = realloc(points,
+					       capacity * sizeof(*points));
+
+			if (!grown) {
+				exit(1);
+			}
+			points = grown;
+		}
+
 		coordinate *tmp = calloc(1, sizeof(coordinate));
 
+		if (!tmp) {
+			exit(1);
+		}
+
 		char *fields[2];
 		char *ptr = buffer;
 
@@ -125,30 +147,37 @@ int main(int argc, char *argv[])
 		}
 
 		tmp->x_coord = strtod(fields[0], &broken);
-		if (*broken) {
+		if (*broken || fields[0] == broken) {
 			printf("broken: %d\n", *broken);
 			fprintf(stderr, "%s broke me\n", buffer);
 			exit(1);
 		}
 		tmp->y_coord = strtod(fields[1], &broken);
 
-		if (*broken) {
+		if (*broken || fields[1] == broken) {
 			printf("broken: %d\n", *broken);
 			fprintf(stderr, "%s broke me\n", buffer);
 			exit(1);
 		}
 
-		int median = find_median(file);
-		ret = tree_insert(tree, tmp, median);
-		if (!ret) {
-			free(tmp);
+		if (fabs(tmp->x_coord) > 180 || fabs(tmp->y_coord) > 180) {
+			printf("Coordinate must be between -180 and 180 "
+			       "degrees\n");
 			exit(1);
 		}
+
+		points[count++] = tmp;
 	}
 	fclose(file);
 
-	coordinate *neighbor = tree_search(tree, x_coord, y_coord);
-	coordinate *neighbor = find_neighbor(x_coord, y_coord);
+	// built in one go around the medians instead of inserting in file
+	// order, which turns sorted input into a list
+	if (!tree_build(tree, points, count)) {
+		exit(1);
+	}
+	free(points);
+
+	find_neighbor(x_coord, y_coord);
 
 	print_visual(tree);
 	tree_destroy(&tree);
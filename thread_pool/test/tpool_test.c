@@ -0,0 +1,537 @@
+/** @file tpool_test.c
+*
+* @brief tpool_test.c tests public functions from tpool.h
+*
+* COPYRIGHT NOTICE: (c) 2023 Jacob Hitchcox
+*
+*/
+
+#include "../tpool.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define NUM_TASKS 1000
+#define NUM_CHILDREN 64
+#define INNER_RANGE 100
+#define OUTER_RANGE 64
+
+static atomic_int counter;
+
+// holds tasks back until opened, so tests can fill a pool's queue
+static atomic_bool gate_open;
+static atomic_bool gate_reached;
+
+static void *count_task(void *arg)
+{
+	atomic_fetch_add(&counter, arg ? *(int *)arg : 1);
+	return NULL;
+}
+
+static void *sleep_task(void *arg)
+{
+	(void)arg;
+	usleep(1000);
+	atomic_fetch_add(&counter, 1);
+	return NULL;
+}
+
+static void *gate_task(void *arg)
+{
+	(void)arg;
+	atomic_store(&gate_reached, true);
+	while (!atomic_load(&gate_open)) {
+		usleep(100);
+	}
+	return NULL;
+}
+
+// lanes in the order their tasks ran
+static tpool_priority_t run_order[TPOOL_PRIORITY_LEVELS];
+static atomic_int next_run;
+
+static void *record_task(void *arg)
+{
+	run_order[atomic_fetch_add(&next_run, 1)] = *(tpool_priority_t *) arg;
+	return NULL;
+}
+
+static void *result_task(void *arg)
+{
+	atomic_fetch_add(&counter, 1);
+	return arg;
+}
+
+// queues its children on the running worker's own deque
+static void *spawn_task(void *arg)
+{
+	tpool_t *tpool = arg;
+
+	for (int i = 0; i < NUM_CHILDREN; i++) {
+		tpool_enqueue(tpool, sleep_task, NULL);
+	}
+	return NULL;
+}
+
+static void gate_reset(void)
+{
+	atomic_store(&gate_open, false);
+	atomic_store(&gate_reached, false);
+}
+
+static void gate_wait_reached(void)
+{
+	while (!atomic_load(&gate_reached)) {
+		usleep(100);
+	}
+}
+
+typedef struct nested_ctx {
+	tpool_t *tpool;
+	atomic_int *marks;
+} nested_ctx;
+
+static void mark_range(size_t begin, size_t end, void *ctx)
+{
+	atomic_int *marks = ctx;
+
+	for (size_t i = begin; i < end; i++) {
+		atomic_fetch_add(&marks[i], 1);
+	}
+}
+
+static void outer_range(size_t begin, size_t end, void *ctx)
+{
+	nested_ctx *nested = ctx;
+
+	for (size_t i = begin; i < end; i++) {
+		tpool_parallel_for(nested->tpool, i * INNER_RANGE,
+				   (i + 1) * INNER_RANGE, 7, mark_range,
+				   nested->marks);
+	}
+}
+
+static void *sum_range(size_t begin, size_t end, void *ctx)
+{
+	(void)ctx;
+	size_t *sum = malloc(sizeof(*sum));
+
+	*sum = 0;
+	for (size_t i = begin; i < end; i++) {
+		*sum += i;
+	}
+	return sum;
+}
+
+static void *sum_combine(void *lhs, void *rhs, void *ctx)
+{
+	(void)ctx;
+	*(size_t *)lhs += *(size_t *)rhs;
+	free(rhs);
+	return lhs;
+}
+
+// opens the gate once the caller is well inside tpool_shutdown()
+static void *late_opener_thread(void *arg)
+{
+	(void)arg;
+	usleep(20000);
+	atomic_store(&gate_open, true);
+	return NULL;
+}
+
+static void *wait_all_thread(void *arg)
+{
+	tpool_wait_all(arg);
+	return NULL;
+}
+
+START_TEST(test_stealing)
+{
+	tpool_options_t options = {.mode = TPOOL_WORK_STEALING };
+	tpool_t *tpool = tpool_create_opts(4, &options);
+	ck_assert(tpool != NULL);
+
+	atomic_store(&counter, 0);
+	ck_assert(tpool_enqueue(tpool, spawn_task, tpool));
+	tpool_wait_all(tpool);
+	ck_assert(atomic_load(&counter) == NUM_CHILDREN);
+
+	// every child went to one deque, the others can only have stolen
+	tpool_stats_t stats;
+	ck_assert(tpool_stats(tpool, &stats));
+	ck_assert(stats.total.tasks_executed == NUM_CHILDREN + 1);
+	int busy = 0;
+	for (int i = 0; i < stats.num_workers; i++) {
+		busy += stats.workers[i].tasks_executed > 0;
+	}
+	ck_assert(busy > 1);
+	tpool_stats_free(&stats);
+
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+	ck_assert(tpool == NULL);
+}
+
+END_TEST START_TEST(test_enqueue_batch)
+{
+	tpool_mode_t modes[] = { TPOOL_SHARED_QUEUE, TPOOL_WORK_STEALING };
+	static task_func_t tasks[NUM_TASKS];
+	static void *args[NUM_TASKS];
+	static int values[NUM_TASKS];
+
+	for (int i = 0; i < NUM_TASKS; i++) {
+		tasks[i] = count_task;
+		values[i] = i;
+		args[i] = &values[i];
+	}
+
+	for (int m = 0; m < 2; m++) {
+		tpool_options_t options = {.mode = modes[m] };
+		tpool_t *tpool = tpool_create_opts(3, &options);
+		ck_assert(tpool != NULL);
+
+		atomic_store(&counter, 0);
+		ck_assert(tpool_enqueue_batch(tpool, tasks, args, NUM_TASKS)
+			  == NUM_TASKS);
+		tpool_wait_all(tpool);
+		ck_assert(atomic_load(&counter) ==
+			  NUM_TASKS * (NUM_TASKS - 1) / 2);
+
+		// NULL args count one each
+		atomic_store(&counter, 0);
+		ck_assert(tpool_enqueue_batch(tpool, tasks, NULL, NUM_TASKS)
+			  == NUM_TASKS);
+		tpool_wait_all(tpool);
+		ck_assert(atomic_load(&counter) == NUM_TASKS);
+
+		ck_assert(tpool_enqueue_batch(tpool, tasks, NULL, 0) == 0);
+		tpool_shutdown(&tpool, TPOOL_DRAIN);
+	}
+}
+
+END_TEST START_TEST(test_wait_all_reuse)
+{
+	tpool_options_t options = {.mode = TPOOL_WORK_STEALING };
+	tpool_t *tpool = tpool_create_opts(2, &options);
+	ck_assert(tpool != NULL);
+
+	// nothing queued returns at once
+	tpool_wait_all(tpool);
+
+	for (int round = 1; round <= 10; round++) {
+		atomic_store(&counter, 0);
+		for (int i = 0; i < 100; i++) {
+			ck_assert(tpool_enqueue(tpool, count_task, NULL));
+		}
+		// tasks enqueued by tasks are waited for too
+		ck_assert(tpool_enqueue(tpool, spawn_task, tpool));
+		tpool_wait_all(tpool);
+		ck_assert(atomic_load(&counter) == 100 + NUM_CHILDREN);
+	}
+
+	// futures carry results across the barrier
+	tpool_future_t *future = tpool_submit(tpool, result_task, &counter);
+	ck_assert(future != NULL);
+	tpool_wait_all(tpool);
+	ck_assert(tpool_future_done(future));
+	ck_assert(tpool_future_get(future) == &counter);
+	tpool_future_destroy(&future);
+	ck_assert(future == NULL);
+
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+}
+
+END_TEST START_TEST(test_parallel_for_nested)
+{
+	tpool_options_t options = {.mode = TPOOL_WORK_STEALING };
+	tpool_t *tpool = tpool_create_opts(4, &options);
+	static atomic_int marks[OUTER_RANGE * INNER_RANGE];
+	ck_assert(tpool != NULL);
+
+	for (int i = 0; i < OUTER_RANGE * INNER_RANGE; i++) {
+		atomic_init(&marks[i], 0);
+	}
+
+	// the outer body runs on workers and blocks in an inner loop
+	nested_ctx nested = {.tpool = tpool,.marks = marks };
+	ck_assert(tpool_parallel_for(tpool, 0, OUTER_RANGE, 1, outer_range,
+				     &nested));
+	for (int i = 0; i < OUTER_RANGE * INNER_RANGE; i++) {
+		ck_assert(atomic_load(&marks[i]) == 1);
+	}
+
+	ck_assert(!tpool_parallel_for(tpool, 0, 10, 1, NULL, NULL));
+	ck_assert(tpool_parallel_for(tpool, 5, 5, 1, mark_range, marks));
+
+	size_t *sum = tpool_parallel_reduce(tpool, 0, 100000, 0, sum_range,
+					    sum_combine, NULL);
+	ck_assert(sum != NULL);
+	ck_assert(*sum == (size_t)100000 * 99999 / 2);
+	free(sum);
+	ck_assert(tpool_parallel_reduce(tpool, 3, 3, 1, sum_range,
+					sum_combine, NULL) == NULL);
+
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+}
+
+END_TEST START_TEST(test_try_enqueue_capacity)
+{
+	tpool_options_t options = {.capacity = 4 };
+	tpool_t *tpool = tpool_create_opts(1, &options);
+	ck_assert(tpool != NULL);
+
+	// the only worker is busy, so everything below stays queued
+	gate_reset();
+	atomic_store(&counter, 0);
+	ck_assert(tpool_enqueue(tpool, gate_task, NULL));
+	gate_wait_reached();
+
+	for (int i = 0; i < 4; i++) {
+		ck_assert(tpool_try_enqueue(tpool, count_task, NULL,
+					    TPOOL_PRIORITY_LOW));
+	}
+	ck_assert(!tpool_try_enqueue(tpool, count_task, NULL,
+				     TPOOL_PRIORITY_NORMAL));
+
+	tpool_stats_t stats;
+	ck_assert(tpool_stats(tpool, &stats));
+	ck_assert(stats.queue_depth == 4);
+	tpool_stats_free(&stats);
+
+	atomic_store(&gate_open, true);
+	tpool_wait_all(tpool);
+	ck_assert(atomic_load(&counter) == 4);
+
+	// room again once the queue drained
+	ck_assert(tpool_try_enqueue(tpool, count_task, NULL,
+				    TPOOL_PRIORITY_HIGH));
+	tpool_wait_all(tpool);
+	ck_assert(atomic_load(&counter) == 5);
+
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+}
+
+END_TEST START_TEST(test_priority)
+{
+	tpool_t *tpool = tpool_create(1);
+	ck_assert(tpool != NULL);
+
+	gate_reset();
+	atomic_store(&next_run, 0);
+	ck_assert(tpool_enqueue(tpool, gate_task, NULL));
+	gate_wait_reached();
+
+	// queued lowest first, they must run highest first
+	static tpool_priority_t lanes[] = { TPOOL_PRIORITY_LOW,
+		TPOOL_PRIORITY_NORMAL, TPOOL_PRIORITY_HIGH
+	};
+	for (int i = 0; i < 3; i++) {
+		ck_assert(tpool_enqueue_priority(tpool, record_task, &lanes[i],
+						 lanes[i]));
+	}
+	atomic_store(&gate_open, true);
+	tpool_wait_all(tpool);
+
+	ck_assert(run_order[0] == TPOOL_PRIORITY_HIGH);
+	ck_assert(run_order[1] == TPOOL_PRIORITY_NORMAL);
+	ck_assert(run_order[2] == TPOOL_PRIORITY_LOW);
+
+	tpool_stats_t stats;
+	ck_assert(tpool_stats(tpool, &stats));
+	ck_assert(stats.total.tasks_executed == 4);
+	ck_assert(stats.peak_depth >= 3);
+	tpool_stats_free(&stats);
+
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+}
+
+END_TEST START_TEST(test_shutdown_drain)
+{
+	tpool_mode_t modes[] = { TPOOL_SHARED_QUEUE, TPOOL_WORK_STEALING };
+
+	for (int m = 0; m < 2; m++) {
+		tpool_options_t options = {.mode = modes[m] };
+		tpool_t *tpool = tpool_create_opts(2, &options);
+		ck_assert(tpool != NULL);
+
+		atomic_store(&counter, 0);
+		for (int i = 0; i < 200; i++) {
+			ck_assert(tpool_enqueue(tpool, sleep_task, NULL));
+		}
+		tpool_shutdown(&tpool, TPOOL_DRAIN);
+		ck_assert(tpool == NULL);
+		ck_assert(atomic_load(&counter) == 200);
+	}
+}
+
+END_TEST START_TEST(test_shutdown_abort)
+{
+	tpool_mode_t modes[] = { TPOOL_SHARED_QUEUE, TPOOL_WORK_STEALING };
+
+	for (int m = 0; m < 2; m++) {
+		tpool_options_t options = {.mode = modes[m] };
+		tpool_t *tpool = tpool_create_opts(1, &options);
+		tpool_future_t *futures[100];
+		ck_assert(tpool != NULL);
+
+		gate_reset();
+		atomic_store(&counter, 0);
+		ck_assert(tpool_enqueue(tpool, gate_task, NULL));
+		gate_wait_reached();
+
+		for (int i = 0; i < 100; i++) {
+			futures[i] = tpool_submit(tpool, result_task, &counter);
+			ck_assert(futures[i] != NULL);
+		}
+
+		// a thread blocked on the barrier is released by the abort
+		pthread_t waiter;
+		ck_assert(0 == pthread_create(&waiter, NULL, wait_all_thread,
+					      tpool));
+		usleep(10000);
+
+		pthread_t opener;
+		ck_assert(0 == pthread_create(&opener, NULL, late_opener_thread,
+					      NULL));
+		tpool_shutdown(&tpool, TPOOL_ABORT);
+		pthread_join(waiter, NULL);
+		pthread_join(opener, NULL);
+
+		// dropped tasks complete their futures with NULL
+		int ran = 0;
+		for (int i = 0; i < 100; i++) {
+			ck_assert(tpool_future_done(futures[i]));
+			ran += tpool_future_get(futures[i]) != NULL;
+			tpool_future_destroy(&futures[i]);
+		}
+		ck_assert(ran == atomic_load(&counter));
+		ck_assert(ran == 0);
+	}
+}
+
+END_TEST START_TEST(test_resize)
+{
+	tpool_options_t options = {.mode = TPOOL_WORK_STEALING,.max_workers =
+		    8
+	};
+	tpool_t *tpool = tpool_create_opts(2, &options);
+	ck_assert(tpool != NULL);
+	ck_assert(tpool_size(tpool) == 2);
+
+	ck_assert(!tpool_resize(tpool, 0));
+	ck_assert(!tpool_resize(tpool, 9));
+	ck_assert(tpool_size(tpool) == 2);
+
+	ck_assert(tpool_resize(tpool, 6));
+	ck_assert(tpool_size(tpool) == 6);
+	atomic_store(&counter, 0);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		ck_assert(tpool_enqueue(tpool, count_task, NULL));
+	}
+	tpool_wait_all(tpool);
+	ck_assert(atomic_load(&counter) == NUM_TASKS);
+
+	// shrink with work still queued on the retiring workers' deques
+	atomic_store(&counter, 0);
+	for (int i = 0; i < 200; i++) {
+		ck_assert(tpool_enqueue(tpool, sleep_task, NULL));
+	}
+	ck_assert(tpool_resize(tpool, 1));
+	ck_assert(tpool_size(tpool) == 1);
+	tpool_wait_all(tpool);
+	ck_assert(atomic_load(&counter) == 200);
+
+	// grow back into slots that retired workers left behind
+	ck_assert(tpool_resize(tpool, 4));
+	ck_assert(tpool_size(tpool) == 4);
+	atomic_store(&counter, 0);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		ck_assert(tpool_enqueue(tpool, count_task, NULL));
+	}
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+	ck_assert(atomic_load(&counter) == NUM_TASKS);
+}
+
+END_TEST START_TEST(test_options)
+{
+	int cpus[] = { 0 };
+	int bad_cpus[] = { -1 };
+	tpool_options_t options = {.affinity = TPOOL_AFFINITY_CORE,.cpus =
+		    cpus,.num_cpus = 1,.thread_name = "tpool-test",.spin_count =
+		    100,.yield_count = 10,.timing = true
+	};
+
+	tpool_t *tpool = tpool_create_opts(2, &options);
+	ck_assert(tpool != NULL);
+
+	atomic_store(&counter, 0);
+	for (int i = 0; i < 100; i++) {
+		ck_assert(tpool_enqueue(tpool, sleep_task, NULL));
+	}
+	tpool_wait_all(tpool);
+	ck_assert(atomic_load(&counter) == 100);
+
+	tpool_stats_t stats;
+	ck_assert(tpool_stats(tpool, &stats));
+	ck_assert(stats.num_workers == 2);
+	ck_assert(stats.total.tasks_executed == 100);
+	ck_assert(stats.total.busy_ns > 0);
+	uint64_t latencies = 0;
+	for (int i = 0; i < TPOOL_LATENCY_BUCKETS; i++) {
+		latencies += stats.total.latency[i];
+	}
+	ck_assert(latencies == 100);
+	tpool_stats_free(&stats);
+	tpool_shutdown(&tpool, TPOOL_DRAIN);
+
+	options.cpus = bad_cpus;
+	ck_assert(tpool_create_opts(2, &options) == NULL);
+
+	ck_assert(tpool_create(0) == NULL);
+	ck_assert(!tpool_enqueue(NULL, count_task, NULL));
+	tpool_wait_all(NULL);
+	tpool_shutdown(NULL, TPOOL_DRAIN);
+}
+
+END_TEST Suite *tpool_check(void)
+{
+	Suite *suite;
+	TCase *tc_core;
+
+	suite = suite_create("tpool_tests");
+
+	tc_core = tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+	tcase_add_test(tc_core, test_stealing);
+	tcase_add_test(tc_core, test_enqueue_batch);
+	tcase_add_test(tc_core, test_wait_all_reuse);
+	tcase_add_test(tc_core, test_parallel_for_nested);
+	tcase_add_test(tc_core, test_try_enqueue_capacity);
+	tcase_add_test(tc_core, test_priority);
+	tcase_add_test(tc_core, test_shutdown_drain);
+	tcase_add_test(tc_core, test_shutdown_abort);
+	tcase_add_test(tc_core, test_resize);
+	tcase_add_test(tc_core, test_options);
+
+	suite_add_tcase(suite, tc_core);
+
+	return suite;
+}
+
+int main()
+{
+	Suite *suite = tpool_check();
+	SRunner *runner = srunner_create(suite);
+
+	srunner_set_fork_status(runner, CK_NOFORK);
+
+	srunner_run_all(runner, CK_VERBOSE);
+
+	int no_failed = srunner_ntests_failed(runner);
+
+	srunner_free(runner);
+	return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*** end of file***/
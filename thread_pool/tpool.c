@@ -1,172 +1,1736 @@
+#define _GNU_SOURCE
 #include "tpool.h"
 
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
 
+#define TASK_SLAB_SIZE 64
+#define CACHE_LINE 64
+#define THREAD_NAME_MAX 16
+
+struct tpool_future {
+	pthread_mutex_t lock;
+	pthread_cond_t done_condition;
+	void *result;
+	bool done;
+};
+
 typedef struct task {
 	task_func_t function;
 	void *argument;
+	tpool_future_t *future;
+	uint64_t enqueued;
 	struct task *next;
+	struct task *prev;
 } task_t;
 
-struct tpool {
-	int num_workers;
-	pthread_t *workers;
-	task_t *task_queue;
-	pthread_mutex_t queue_mutex;
-	pthread_cond_t queue_condition;
-	bool shutdown;
-};
+/*
+ * Task nodes are carved out of slabs and recycled through a free list owned by
+ * the queue they were allocated for, so steady state enqueues never touch the
+ * heap. Slabs are only released when the pool shuts down.
+ */
+typedef struct task_slab {
+	struct task_slab *next;
+	task_t tasks[TASK_SLAB_SIZE];
+} task_slab_t;
+
+typedef struct task_lane {
+	task_t *head;
+	task_t *tail;
+} task_lane_t;
+
+/*
+ * Doubly linked task deque with one lane per priority, higher priority lanes
+ * are always drained first. The shared queue pushes at the tail and pops at the
+ * head. In TPOOL_WORK_STEALING mode the owning worker pushes and pops at the
+ * tail, thieves take from the head so they get the oldest (and usually
+ * largest) pieces of work. Callers hold the lock guarding the deque.
+ */
+typedef struct task_deque {
+	task_lane_t lanes[TPOOL_PRIORITY_LEVELS];
+	task_t *free_list;
+	task_slab_t *slabs;
+	atomic_int count;
+} task_deque_t;
+
+/*
+ * Counters only ever written by the owning worker, readers take a racy but
+ * tear-free snapshot.
+ */
+typedef struct worker_stats {
+	atomic_uint_fast64_t tasks_executed;
+	atomic_uint_fast64_t busy_ns;
+	atomic_uint_fast64_t idle_ns;
+	atomic_uint_fast64_t lock_wait_ns;
+	atomic_uint_fast64_t parks;
+	atomic_uint_fast64_t spin_wakeups;
+	atomic_uint_fast64_t yield_wakeups;
+	atomic_uint_fast64_t latency[TPOOL_LATENCY_BUCKETS];
+} worker_stats_t;
+
+/*
+ * Per-worker state. Each worker allocates its own copy after it has been
+ * pinned, so first touch places it on the worker's local NUMA node, and pads
+ * it to a cache line so neighbours never share one. A retired worker's state
+ * outlives its thread so tasks left on its deque can still be stolen, and is
+ * picked up again if the pool grows back into that slot.
+ */
+typedef struct worker {
+	tpool_t *tpool;
+	int id;
+	atomic_bool retired;
+	pthread_mutex_t lock;
+	task_deque_t deque;
+	worker_stats_t stats;
+} worker_t;
+
+typedef struct worker_launch {
+	tpool_t *tpool;
+	int id;
+} worker_launch_t;
+
+/*
+ * Worker slots are allocated up front for max_workers. num_workers counts the
+ * slots that have state (only ever grows), active counts the running threads,
+ * which always own the slots [0, active).
+ */
+struct tpool {
+	int max_workers;
+	atomic_int num_workers;
+	atomic_int active;
+	tpool_mode_t mode;
+	size_t capacity;
+	unsigned int spin_count;
+	unsigned int yield_count;
+	bool timing;
+	pthread_t *workers;
+	worker_t **locals;
+	tpool_affinity_t affinity;
+	int *cpus;
+	int num_cpus;
+	char *thread_name;
+	int started;
+	bool running;
+	bool start_failed;
+	task_deque_t task_queue;
+	pthread_mutex_t queue_mutex;
+	pthread_cond_t queue_condition;
+	pthread_cond_t ready_condition;
+	pthread_mutex_t wait_mutex;
+	pthread_cond_t wait_condition;
+	// threads inside tpool_wait_all(), guarded by wait_mutex
+	int waiters;
+	pthread_mutex_t space_mutex;
+	pthread_cond_t space_condition;
+	pthread_mutex_t resize_mutex;
+	atomic_size_t outstanding;
+	atomic_size_t pending;
+	atomic_size_t peak_pending;
+	atomic_int sleepers;
+	atomic_int blocked_producers;
+	atomic_uint next_worker;
+	atomic_bool shutdown;
+};
+
+// worker owning the calling thread, NULL outside of the pool
+static _Thread_local worker_t *current_worker;
+
+static task_t *task_alloc(task_deque_t * deque)
+{
+	if (!deque->free_list) {
+		task_slab_t *slab = malloc(sizeof(task_slab_t));
+		if (!slab) {
+			return NULL;
+		}
+		slab->next = deque->slabs;
+		deque->slabs = slab;
+
+		for (int i = 0; i < TASK_SLAB_SIZE; i++) {
+			slab->tasks[i].next = deque->free_list;
+			deque->free_list = &slab->tasks[i];
+		}
+	}
+
+	task_t *task = deque->free_list;
+	deque->free_list = task->next;
+
+	return task;
+}				/* task_alloc() */
+
+static void task_recycle(task_deque_t * deque, task_t * task)
+{
+	task->next = deque->free_list;
+	deque->free_list = task;
+}				/* task_recycle() */
+
+static void deque_push_tail(task_deque_t * deque, task_t * task,
+			    tpool_priority_t priority)
+{
+	task_lane_t *lane = &deque->lanes[priority];
+
+	task->next = NULL;
+	task->prev = lane->tail;
+
+	if (lane->tail) {
+		lane->tail->next = task;
+	} else {
+		lane->head = task;
+	}
+	lane->tail = task;
+	atomic_fetch_add_explicit(&deque->count, 1, memory_order_relaxed);
+}				/* deque_push_tail() */
+
+static bool deque_take_tail(task_deque_t * deque, task_t * out)
+{
+	for (int i = 0; i < TPOOL_PRIORITY_LEVELS; i++) {
+		task_lane_t *lane = &deque->lanes[i];
+		task_t *task = lane->tail;
+		if (!task) {
+			continue;
+		}
+
+		lane->tail = task->prev;
+		if (lane->tail) {
+			lane->tail->next = NULL;
+		} else {
+			lane->head = NULL;
+		}
+		atomic_fetch_sub_explicit(&deque->count, 1,
+					  memory_order_relaxed);
+
+		*out = *task;
+		task_recycle(deque, task);
+
+		return true;
+	}
+
+	return false;
+}				/* deque_take_tail() */
+
+static bool deque_take_head(task_deque_t * deque, task_t * out)
+{
+	for (int i = 0; i < TPOOL_PRIORITY_LEVELS; i++) {
+		task_lane_t *lane = &deque->lanes[i];
+		task_t *task = lane->head;
+		if (!task) {
+			continue;
+		}
+
+		lane->head = task->next;
+		if (lane->head) {
+			lane->head->prev = NULL;
+		} else {
+			lane->tail = NULL;
+		}
+		atomic_fetch_sub_explicit(&deque->count, 1,
+					  memory_order_relaxed);
+
+		*out = *task;
+		task_recycle(deque, task);
+
+		return true;
+	}
+
+	return false;
+}				/* deque_take_head() */
+
+static void future_complete(tpool_future_t * future, void *result)
+{
+	pthread_mutex_lock(&future->lock);
+	future->result = result;
+	future->done = true;
+	pthread_cond_broadcast(&future->done_condition);
+	pthread_mutex_unlock(&future->lock);
+}				/* future_complete() */
+
+static void deque_free(task_deque_t * deque)
+{
+	// tasks that never ran still release whoever waits on their future
+	for (int i = 0; i < TPOOL_PRIORITY_LEVELS; i++) {
+		task_t *task = deque->lanes[i].head;
+		for (; task != NULL; task = task->next) {
+			if (task->future) {
+				future_complete(task->future, NULL);
+			}
+		}
+		deque->lanes[i].head = NULL;
+		deque->lanes[i].tail = NULL;
+	}
+
+	// every node, queued or recycled, lives in one of the slabs
+	task_slab_t *slab = deque->slabs;
+	while (slab != NULL) {
+		task_slab_t *next_slab = slab->next;
+		free(slab);
+		slab = next_slab;
+	}
+
+	deque->free_list = NULL;
+	deque->slabs = NULL;
+}				/* deque_free() */
+
+static inline void counter_add(atomic_uint_fast64_t * counter, uint64_t n)
+{
+	// single writer, so no locked read-modify-write is needed
+	atomic_store_explicit(counter,
+			      atomic_load_explicit(counter,
+						   memory_order_relaxed) + n,
+			      memory_order_relaxed);
+}				/* counter_add() */
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}				/* now_ns() */
+
+// bucket i counts latencies in [2^i, 2^(i+1)) ns, the last one catches the rest
+static int latency_bucket(uint64_t ns)
+{
+	int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	return bucket < TPOOL_LATENCY_BUCKETS ? bucket :
+	    TPOOL_LATENCY_BUCKETS - 1;
+}				/* latency_bucket() */
+
+/*
+ * Locks mutex on behalf of a worker, charging any time spent blocked to its
+ * lock wait counter. The uncontended path is a single trylock.
+ */
+static void worker_lock(worker_t * self, pthread_mutex_t * mutex)
+{
+	if (!self || !self->tpool->timing) {
+		pthread_mutex_lock(mutex);
+		return;
+	}
+
+	if (0 == pthread_mutex_trylock(mutex)) {
+		return;
+	}
+
+	uint64_t start = now_ns();
+	pthread_mutex_lock(mutex);
+	counter_add(&self->stats.lock_wait_ns, now_ns() - start);
+}				/* worker_lock() */
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}				/* cpu_relax() */
+
+// raises the high-water mark, only writes the shared line on a new peak
+static inline void note_depth(tpool_t * tpool, size_t depth)
+{
+	size_t peak = atomic_load_explicit(&tpool->peak_pending,
+					   memory_order_relaxed);
+
+	while (depth > peak
+	       && !atomic_compare_exchange_weak_explicit(&tpool->peak_pending,
+							 &peak, depth,
+							 memory_order_relaxed,
+							 memory_order_relaxed)) {
+	}
+}				/* note_depth() */
+
+/*
+ * Reserves up to want queue slots and returns how many it got. With block set
+ * it waits for room to free up, otherwise it gives up as soon as the pool is
+ * full.
+ */
+static size_t reserve_slots(tpool_t * tpool, size_t want, bool block)
+{
+	size_t capacity = tpool->capacity;
+	worker_t *self = current_worker;
+
+	// only workers can make room, so tasks spawned by tasks are never held
+	// back; waiting there could deadlock the whole pool
+	if (0 == capacity || (self && self->tpool == tpool)) {
+		note_depth(tpool, atomic_fetch_add(&tpool->pending, want) + want);
+		return want;
+	}
+
+	size_t queued = atomic_load(&tpool->pending);
+	while (true) {
+		if (queued < capacity) {
+			size_t room = capacity - queued;
+			size_t got = room < want ? room : want;
+
+			if (atomic_compare_exchange_weak(&tpool->pending,
+							 &queued,
+							 queued + got)) {
+				note_depth(tpool, queued + got);
+				return got;
+			}
+			continue;
+		}
+
+		if (!block || tpool->shutdown) {
+			return 0;
+		}
+		// blocked_producers is raised before pending is re-checked, so
+		// release_slots() either sees us waiting or we see the room
+		pthread_mutex_lock(&tpool->space_mutex);
+		atomic_fetch_add(&tpool->blocked_producers, 1);
+
+		while (atomic_load(&tpool->pending) >= capacity
+		       && !tpool->shutdown) {
+			pthread_cond_wait(&tpool->space_condition,
+					  &tpool->space_mutex);
+		}
+
+		atomic_fetch_sub(&tpool->blocked_producers, 1);
+		pthread_mutex_unlock(&tpool->space_mutex);
+
+		queued = atomic_load(&tpool->pending);
+	}
+}				/* reserve_slots() */
+
+static void release_slots(tpool_t * tpool, size_t n)
+{
+	atomic_fetch_sub(&tpool->pending, n);
+
+	if (atomic_load(&tpool->blocked_producers) > 0) {
+		pthread_mutex_lock(&tpool->space_mutex);
+		if (1 == n) {
+			pthread_cond_signal(&tpool->space_condition);
+		} else {
+			pthread_cond_broadcast(&tpool->space_condition);
+		}
+		pthread_mutex_unlock(&tpool->space_mutex);
+	}
+}				/* release_slots() */
+
+static bool steal_task(tpool_t * tpool, worker_t * self, int first,
+		       task_t * out)
+{
+	// walk every deque once, starting at first, retired ones included
+	int num_workers = atomic_load(&tpool->num_workers);
+
+	for (int i = 0; i < num_workers; i++) {
+		worker_t *victim = tpool->locals[(first + i) % num_workers];
+
+		// cheap emptiness check so idle thieves don't hammer locks
+		if (0 == atomic_load_explicit(&victim->deque.count,
+					      memory_order_relaxed)) {
+			continue;
+		}
+
+		worker_lock(self, &victim->lock);
+		bool found = deque_take_head(&victim->deque, out);
+		pthread_mutex_unlock(&victim->lock);
+
+		if (found) {
+			return true;
+		}
+	}
+
+	return false;
+}				/* steal_task() */
+
+/*
+ * Takes one queued task without blocking. self is the calling worker, or NULL
+ * for a thread outside the pool helping while it waits.
+ */
+static bool find_task(tpool_t * tpool, worker_t * self, task_t * out)
+{
+	bool found = false;
+
+	// the shared queue holds everything in TPOOL_SHARED_QUEUE mode and the
+	// latency-critical lane in TPOOL_WORK_STEALING mode
+	if (atomic_load_explicit(&tpool->task_queue.count,
+				 memory_order_relaxed) > 0) {
+		worker_lock(self, &tpool->queue_mutex);
+		found = deque_take_head(&tpool->task_queue, out);
+		pthread_mutex_unlock(&tpool->queue_mutex);
+	}
+
+	if (!found && self && TPOOL_WORK_STEALING == tpool->mode) {
+		// newest local work first, it is most likely still in cache
+		worker_lock(self, &self->lock);
+		found = deque_take_tail(&self->deque, out);
+		pthread_mutex_unlock(&self->lock);
+	}
+
+	if (!found && TPOOL_WORK_STEALING == tpool->mode) {
+		// start with our right-hand neighbour
+		found = steal_task(tpool, self, self ? self->id + 1 : 0, out);
+	}
+
+	if (found) {
+		release_slots(tpool, 1);
+	}
+
+	return found;
+}				/* find_task() */
+
+// drops n from the outstanding count, waking tpool_wait_all() at zero
+static void tasks_finished(tpool_t * tpool, size_t n)
+{
+	if (n > 0 && n == atomic_fetch_sub(&tpool->outstanding, n)) {
+		pthread_mutex_lock(&tpool->wait_mutex);
+		pthread_cond_broadcast(&tpool->wait_condition);
+		pthread_mutex_unlock(&tpool->wait_mutex);
+	}
+}				/* tasks_finished() */
+
+/*
+ * Runs one task. self is the worker running it, or NULL for a thread outside
+ * the pool, which keeps no counters.
+ */
+static void run_task(tpool_t * tpool, worker_t * self, task_t * task)
+{
+	uint64_t start = 0;
+
+	if (self && tpool->timing) {
+		start = now_ns();
+		if (task->enqueued && start > task->enqueued) {
+			int bucket = latency_bucket(start - task->enqueued);
+			counter_add(&self->stats.latency[bucket], 1);
+		}
+	}
+
+	void *result = task->function(task->argument);
+
+	if (task->future) {
+		future_complete(task->future, result);
+	}
+
+	if (self) {
+		counter_add(&self->stats.tasks_executed, 1);
+		if (tpool->timing) {
+			counter_add(&self->stats.busy_ns, now_ns() - start);
+		}
+	}
+	tasks_finished(tpool, 1);
+}				/* run_task() */
+
+/*
+ * First two stages of the idle policy: spin with a pause hint, then yield the
+ * cpu, polling for work in between. Returns true if work or shutdown showed up
+ * before the worker has to park.
+ */
+static bool idle_spin(worker_t * self)
+{
+	tpool_t *tpool = self->tpool;
+
+	for (unsigned int i = 0; i < tpool->spin_count; i++) {
+		if (atomic_load_explicit(&tpool->pending, memory_order_relaxed)
+		    || tpool->shutdown) {
+			counter_add(&self->stats.spin_wakeups, 1);
+			return true;
+		}
+		cpu_relax();
+	}
+
+	for (unsigned int i = 0; i < tpool->yield_count; i++) {
+		if (atomic_load_explicit(&tpool->pending, memory_order_relaxed)
+		    || tpool->shutdown) {
+			counter_add(&self->stats.yield_wakeups, 1);
+			return true;
+		}
+		sched_yield();
+	}
+
+	return false;
+}				/* idle_spin() */
+
+static inline bool worker_retired(worker_t * self)
+{
+	return atomic_load_explicit(&self->retired, memory_order_relaxed);
+}				/* worker_retired() */
+
+static bool shared_queue_empty(tpool_t * tpool)
+{
+	return 0 == atomic_load_explicit(&tpool->task_queue.count,
+					 memory_order_relaxed);
+}				/* shared_queue_empty() */
+
+static void *shared_worker_thread(worker_t * self)
+{
+	tpool_t *tpool = self->tpool;
+	bool spins = tpool->spin_count > 0 || tpool->yield_count > 0;
+
+	while (true) {
+		// wait for task enqueue or shutdown
+		worker_lock(self, &tpool->queue_mutex);
+
+		uint64_t idle_start = 0;
+		if (tpool->timing && shared_queue_empty(tpool)) {
+			idle_start = now_ns();
+		}
+
+		if (spins && shared_queue_empty(tpool) && !tpool->shutdown
+		    && !worker_retired(self)) {
+			pthread_mutex_unlock(&tpool->queue_mutex);
+			idle_spin(self);
+			pthread_mutex_lock(&tpool->queue_mutex);
+		}
+
+		while (shared_queue_empty(tpool) && !tpool->shutdown
+		       && !worker_retired(self)) {
+			atomic_fetch_add(&tpool->sleepers, 1);
+			counter_add(&self->stats.parks, 1);
+			pthread_cond_wait(&tpool->queue_condition,
+					  &tpool->queue_mutex);
+			atomic_fetch_sub(&tpool->sleepers, 1);
+		}
+
+		if (idle_start) {
+			counter_add(&self->stats.idle_ns, now_ns() - idle_start);
+		}
+		// if shutdown or retired by tpool_resize(), exit the thread
+		if (tpool->shutdown || worker_retired(self)) {
+			pthread_mutex_unlock(&tpool->queue_mutex);
+			pthread_exit(NULL);
+		}
+		// get next task from queue, its node goes straight back on
+		// the free list
+		task_t task;
+		bool found = deque_take_head(&tpool->task_queue, &task);
+
+		// unlock mutex
+		pthread_mutex_unlock(&tpool->queue_mutex);
+
+		// execute the function
+		if (found) {
+			release_slots(tpool, 1);
+			run_task(tpool, self, &task);
+		}
+	}
+}				/* shared_worker_thread() */
+
+static void *stealing_worker_thread(worker_t * self)
+{
+	tpool_t *tpool = self->tpool;
+	while (!tpool->shutdown && !worker_retired(self)) {
+		task_t task;
+		if (find_task(tpool, self, &task)) {
+			// execute the function
+			run_task(tpool, self, &task);
+			continue;
+		}
+
+		uint64_t idle_start = tpool->timing ? now_ns() : 0;
+
+		if (idle_spin(self)) {
+			if (idle_start) {
+				counter_add(&self->stats.idle_ns,
+					    now_ns() - idle_start);
+			}
+			continue;
+		}
+		// nothing anywhere, park until an enqueue or shutdown. sleepers
+		// is raised before pending is re-checked so an enqueuer either
+		// sees us asleep or we see its task.
+		pthread_mutex_lock(&tpool->queue_mutex);
+		atomic_fetch_add(&tpool->sleepers, 1);
+
+		while (0 == atomic_load(&tpool->pending) && !tpool->shutdown
+		       && !worker_retired(self)) {
+			counter_add(&self->stats.parks, 1);
+			pthread_cond_wait(&tpool->queue_condition,
+					  &tpool->queue_mutex);
+		}
+
+		atomic_fetch_sub(&tpool->sleepers, 1);
+		pthread_mutex_unlock(&tpool->queue_mutex);
+
+		if (idle_start) {
+			counter_add(&self->stats.idle_ns, now_ns() - idle_start);
+		}
+	}
+
+	return NULL;
+}				/* stealing_worker_thread() */
+
+static worker_t *worker_alloc(tpool_t * tpool, int id)
+{
+	size_t size = (sizeof(worker_t) + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+
+	worker_t *self = aligned_alloc(CACHE_LINE, size);
+	if (!self) {
+		return NULL;
+	}
+
+	memset(self, 0, size);
+	self->tpool = tpool;
+	self->id = id;
+	atomic_init(&self->retired, false);
+	pthread_mutex_init(&self->lock, NULL);
+	atomic_init(&self->deque.count, 0);
+	atomic_init(&self->stats.tasks_executed, 0);
+	atomic_init(&self->stats.busy_ns, 0);
+	atomic_init(&self->stats.idle_ns, 0);
+	atomic_init(&self->stats.lock_wait_ns, 0);
+	atomic_init(&self->stats.parks, 0);
+	atomic_init(&self->stats.spin_wakeups, 0);
+	atomic_init(&self->stats.yield_wakeups, 0);
+	for (int i = 0; i < TPOOL_LATENCY_BUCKETS; i++) {
+		atomic_init(&self->stats.latency[i], 0);
+	}
+
+	// fault in the first slab of task nodes from here as well
+	task_t *warm = task_alloc(&self->deque);
+	if (warm) {
+		task_recycle(&self->deque, warm);
+	}
+
+	return self;
+}				/* worker_alloc() */
+
+static void worker_free(worker_t * self)
+{
+	if (!self) {
+		return;
+	}
+
+	deque_free(&self->deque);
+	pthread_mutex_destroy(&self->lock);
+	free(self);
+}				/* worker_free() */
+
+static void *worker_thread(void *arg)
+{
+	worker_launch_t *launch = arg;
+	tpool_t *tpool = launch->tpool;
+	int id = launch->id;
+	free(launch);
+
+	// a slot that ran before keeps its state, otherwise allocate it now:
+	// the thread already runs on its cpu set, so this lands on local memory
+	worker_t *self = tpool->locals[id];
+	bool fresh = !self;
+	if (fresh) {
+		self = worker_alloc(tpool, id);
+	}
+
+	if (tpool->thread_name) {
+		char name[THREAD_NAME_MAX];
+		snprintf(name, sizeof(name), "%s-%d", tpool->thread_name, id);
+		pthread_setname_np(pthread_self(), name);
+	}
+	// report in, then wait until every worker is registered so thieves
+	// never see a half built pool
+	pthread_mutex_lock(&tpool->queue_mutex);
+	if (fresh) {
+		tpool->locals[id] = self;
+	}
+	tpool->start_failed |= !self;
+	tpool->started++;
+	pthread_cond_broadcast(&tpool->ready_condition);
+
+	while (!tpool->running && !tpool->shutdown) {
+		pthread_cond_wait(&tpool->ready_condition, &tpool->queue_mutex);
+	}
+	pthread_mutex_unlock(&tpool->queue_mutex);
+
+	if (!self) {
+		return NULL;
+	}
+	current_worker = self;
+
+	if (TPOOL_WORK_STEALING == tpool->mode) {
+		return stealing_worker_thread(self);
+	}
+	return shared_worker_thread(self);
+}				/* worker_thread() */
+
+static bool start_worker(tpool_t * tpool, int id)
+{
+	worker_launch_t *launch = malloc(sizeof(worker_launch_t));
+	if (!launch) {
+		return false;
+	}
+	launch->tpool = tpool;
+	launch->id = id;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+
+	// pin before the thread starts so its first allocation is node local
+	if (TPOOL_AFFINITY_NONE != tpool->affinity) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		if (TPOOL_AFFINITY_CORE == tpool->affinity) {
+			CPU_SET(tpool->cpus[id % tpool->num_cpus], &set);
+		} else {
+			for (int i = 0; i < tpool->num_cpus; i++) {
+				CPU_SET(tpool->cpus[i], &set);
+			}
+		}
+		// an unpinned worker would fail the caller's request silently
+		if (0 != pthread_attr_setaffinity_np(&attr, sizeof(set),
+						     &set)) {
+			pthread_attr_destroy(&attr);
+			free(launch);
+			return false;
+		}
+	}
+
+	// also fails if none of the cpus is online or allowed for us
+	int ret = pthread_create(&tpool->workers[id], &attr, worker_thread,
+				 launch);
+	pthread_attr_destroy(&attr);
+
+	if (0 != ret) {
+		free(launch);
+		return false;
+	}
+
+	return true;
+}				/* start_worker() */
+
+// copies the cpu list to pin to, defaulting to every cpu we may run on
+static bool setup_affinity(tpool_t * tpool, const tpool_options_t * options)
+{
+	tpool->affinity = options ? options->affinity : TPOOL_AFFINITY_NONE;
+	tpool->cpus = NULL;
+	tpool->num_cpus = 0;
+
+	if (TPOOL_AFFINITY_NONE == tpool->affinity) {
+		return true;
+	}
+
+	if (options->cpus && options->num_cpus > 0) {
+		// CPU_SET() has no bounds check of its own
+		for (int i = 0; i < options->num_cpus; i++) {
+			if (options->cpus[i] < 0
+			    || options->cpus[i] >= CPU_SETSIZE) {
+				return false;
+			}
+		}
+
+		tpool->cpus = malloc(sizeof(int) * options->num_cpus);
+		if (!tpool->cpus) {
+			return false;
+		}
+		memcpy(tpool->cpus, options->cpus,
+		       sizeof(int) * options->num_cpus);
+		tpool->num_cpus = options->num_cpus;
+
+		return true;
+	}
+
+	cpu_set_t allowed;
+	if (0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		return false;
+	}
+
+	tpool->cpus = malloc(sizeof(int) * CPU_COUNT(&allowed));
+	if (!tpool->cpus) {
+		return false;
+	}
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed)) {
+			tpool->cpus[tpool->num_cpus++] = cpu;
+		}
+	}
+
+	return tpool->num_cpus > 0;
+}				/* setup_affinity() */
+
+tpool_t *tpool_create(int num_workers)
+{
+	return tpool_create_opts(num_workers, NULL);
+}				/* tpool_create() */
+
+tpool_t *tpool_create_opts(int num_workers, const tpool_options_t * options)
+{
+	if (num_workers < 1) {
+		return NULL;
+	}
+
+	int max_workers = options ? options->max_workers : 0;
+	if (max_workers < 1) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		max_workers = online > 0 ? (int)online : 1;
+	}
+	if (max_workers < num_workers) {
+		max_workers = num_workers;
+	}
+
+	tpool_mode_t mode = options ? options->mode : TPOOL_SHARED_QUEUE;
+	size_t capacity = options ? options->capacity : 0;
+	if (mode != TPOOL_SHARED_QUEUE && mode != TPOOL_WORK_STEALING) {
+		return NULL;
+	}
+	// allocate struct
+	tpool_t *tpool = calloc(1, sizeof(tpool_t));
+	if (!tpool) {
+		return NULL;
+	}
+
+	tpool->max_workers = max_workers;
+	atomic_init(&tpool->num_workers, num_workers);
+	atomic_init(&tpool->active, num_workers);
+	tpool->mode = mode;
+	tpool->capacity = capacity;
+	tpool->spin_count = options ? options->spin_count : 0;
+	tpool->yield_count = options ? options->yield_count : 0;
+	tpool->timing = options ? options->timing : false;
+	tpool->workers = malloc(sizeof(pthread_t) * max_workers);
+	tpool->locals = calloc(max_workers, sizeof(worker_t *));
+
+	if (options && options->thread_name) {
+		tpool->thread_name = strdup(options->thread_name);
+	}
+
+	if (!tpool->workers || !tpool->locals || !setup_affinity(tpool, options)
+	    || (options && options->thread_name && !tpool->thread_name)) {
+		free(tpool->workers);
+		free(tpool->locals);
+		free(tpool->cpus);
+		free(tpool->thread_name);
+		free(tpool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&tpool->queue_mutex, NULL);
+	pthread_cond_init(&tpool->queue_condition, NULL);
+	pthread_cond_init(&tpool->ready_condition, NULL);
+	pthread_mutex_init(&tpool->wait_mutex, NULL);
+	pthread_cond_init(&tpool->wait_condition, NULL);
+	pthread_mutex_init(&tpool->space_mutex, NULL);
+	pthread_cond_init(&tpool->space_condition, NULL);
+	pthread_mutex_init(&tpool->resize_mutex, NULL);
+	atomic_init(&tpool->task_queue.count, 0);
+	atomic_init(&tpool->outstanding, 0);
+	atomic_init(&tpool->pending, 0);
+	atomic_init(&tpool->peak_pending, 0);
+	atomic_init(&tpool->sleepers, 0);
+	atomic_init(&tpool->blocked_producers, 0);
+	atomic_init(&tpool->next_worker, 0);
+	atomic_init(&tpool->shutdown, false);
+
+	// create threads
+	int created = 0;
+	while (created < num_workers && start_worker(tpool, created)) {
+		created++;
+	}
+
+	// wait for every thread to allocate and register its state
+	pthread_mutex_lock(&tpool->queue_mutex);
+	while (tpool->started < created) {
+		pthread_cond_wait(&tpool->ready_condition, &tpool->queue_mutex);
+	}
+
+	if (created < num_workers || tpool->start_failed) {
+		pthread_mutex_unlock(&tpool->queue_mutex);
+
+		// tear down whatever did start
+		tpool->num_workers = created;
+		tpool->active = created;
+		tpool_shutdown(&tpool, TPOOL_ABORT);
+		return NULL;
+	}
+
+	tpool->running = true;
+	pthread_cond_broadcast(&tpool->ready_condition);
+	pthread_mutex_unlock(&tpool->queue_mutex);
+
+	return tpool;
+}				/* tpool_create_opts() */
+
+// callers of signal_sleepers() hold queue_mutex
+static void signal_sleepers(tpool_t * tpool, size_t count)
+{
+	size_t sleepers = atomic_load(&tpool->sleepers);
+
+	if (0 == sleepers) {
+		return;
+	}
+
+	if (count >= sleepers) {
+		pthread_cond_broadcast(&tpool->queue_condition);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		pthread_cond_signal(&tpool->queue_condition);
+	}
+}				/* signal_sleepers() */
+
+static void wake_workers(tpool_t * tpool, size_t count)
+{
+	// only touch the shared lock when somebody is actually asleep
+	if (0 == count || 0 == atomic_load(&tpool->sleepers)) {
+		return;
+	}
+
+	pthread_mutex_lock(&tpool->queue_mutex);
+	signal_sleepers(tpool, count);
+	pthread_mutex_unlock(&tpool->queue_mutex);
+}				/* wake_workers() */
 
-static void *worker_thread(void *arg)
+static worker_t *enqueue_target(tpool_t * tpool)
 {
-	tpool_t *tpool = arg;
-	while (true) {
-		// wait for task enqueue or shutdown
-		pthread_mutex_lock(&tpool->queue_mutex);
+	worker_t *target = current_worker;
 
-		while (!tpool->task_queue && !tpool->shutdown) {
-			pthread_cond_wait(&tpool->queue_condition,
-					  &tpool->queue_mutex);
-		}
+	// tasks spawned from inside the pool stay with their worker, anything
+	// submitted from outside is spread round-robin over the deques
+	if (!target || target->tpool != tpool) {
+		unsigned int next = atomic_fetch_add_explicit(&tpool->next_worker,
+							      1,
+							      memory_order_relaxed);
+		target = tpool->locals[next % atomic_load(&tpool->active)];
+	}
 
-		// if shutdown, exit the thread
-		if (tpool->shutdown) {
-			pthread_mutex_unlock(&tpool->queue_mutex);
-			pthread_exit(NULL);
-		}
-		// get next task from queue
-		task_t *task = tpool->task_queue;
+	return target;
+}				/* enqueue_target() */
 
-		if (!task) {
-			// release mutex
-			pthread_mutex_unlock(&tpool->queue_mutex);
-			continue;
+// appends up to n tasks to deque, returns how many fit before malloc failed
+static size_t deque_splice(task_deque_t * deque, task_func_t * tasks,
+			   void **args, size_t n, uint64_t enqueued)
+{
+	for (size_t i = 0; i < n; i++) {
+		task_t *new_task = task_alloc(deque);
+		if (!new_task) {
+			return i;
 		}
-		tpool->task_queue = task->next;
+		new_task->function = tasks[i];
+		new_task->argument = args ? args[i] : NULL;
+		new_task->future = NULL;
+		new_task->enqueued = enqueued;
+		deque_push_tail(deque, new_task, TPOOL_PRIORITY_NORMAL);
+	}
 
-		// unlock mutex
-		pthread_mutex_unlock(&tpool->queue_mutex);
+	return n;
+}				/* deque_splice() */
 
-		// execute the function
-		task->function(task->argument);
+static bool enqueue_task(tpool_t * tpool, task_func_t task, void *arg,
+			 tpool_future_t * future, tpool_priority_t priority,
+			 bool block)
+{
+	if (0 == reserve_slots(tpool, 1, block)) {
+		return false;
+	}
+	// counted before the task is visible so a worker can never finish it
+	// before it is accounted for
+	atomic_fetch_add(&tpool->outstanding, 1);
 
-		// free task
-		free(task);
+	// the shared queue also carries the latency-critical lane of a work
+	// stealing pool, every worker checks it before its own deque
+	pthread_mutex_t *lock = &tpool->queue_mutex;
+	task_deque_t *deque = &tpool->task_queue;
+	if (TPOOL_WORK_STEALING == tpool->mode
+	    && TPOOL_PRIORITY_HIGH != priority) {
+		worker_t *target = enqueue_target(tpool);
+		lock = &target->lock;
+		deque = &target->deque;
 	}
-}				/* worker_thread() */
+	// lock mutex
+	pthread_mutex_lock(lock);
 
-tpool_t *tpool_create(int num_workers)
+	// take a node from the free list, only hits malloc when it is empty
+	task_t *new_task = task_alloc(deque);
+	if (!new_task) {
+		pthread_mutex_unlock(lock);
+		release_slots(tpool, 1);
+		tasks_finished(tpool, 1);
+		return false;
+	}
+	// initialize variables
+	new_task->function = task;
+	new_task->argument = arg;
+	new_task->future = future;
+	new_task->enqueued = tpool->timing ? now_ns() : 0;
+
+	// add new task at the tail of its lane
+	deque_push_tail(deque, new_task, priority);
+
+	// signal thread to process new task
+	if (lock == &tpool->queue_mutex) {
+		signal_sleepers(tpool, 1);
+		pthread_mutex_unlock(lock);
+	} else {
+		pthread_mutex_unlock(lock);
+		wake_workers(tpool, 1);
+	}
+
+	return true;
+}				/* enqueue_task() */
+
+bool tpool_enqueue(tpool_t * tpool, task_func_t task, void *arg)
 {
-	if (num_workers < 1) {
+	return tpool_enqueue_priority(tpool, task, arg, TPOOL_PRIORITY_NORMAL);
+}				/* tpool_enqueue() */
+
+bool tpool_enqueue_priority(tpool_t * tpool, task_func_t task, void *arg,
+			    tpool_priority_t priority)
+{
+	if (!tpool || !task || tpool->shutdown
+	    || priority < 0 || priority >= TPOOL_PRIORITY_LEVELS) {
+		return false;
+	}
+
+	return enqueue_task(tpool, task, arg, NULL, priority, true);
+}				/* tpool_enqueue_priority() */
+
+bool tpool_try_enqueue(tpool_t * tpool, task_func_t task, void *arg,
+		       tpool_priority_t priority)
+{
+	if (!tpool || !task || tpool->shutdown
+	    || priority < 0 || priority >= TPOOL_PRIORITY_LEVELS) {
+		return false;
+	}
+
+	return enqueue_task(tpool, task, arg, NULL, priority, false);
+}				/* tpool_try_enqueue() */
+
+tpool_future_t *tpool_submit(tpool_t * tpool, task_func_t task, void *arg)
+{
+	if (!tpool || !task || tpool->shutdown) {
 		return NULL;
 	}
-	// allocate struct
-	tpool_t *tpool = malloc(sizeof(tpool_t));
-	if (!tpool) {
+
+	tpool_future_t *future = malloc(sizeof(tpool_future_t));
+	if (!future) {
 		return NULL;
 	}
 
-	tpool->num_workers = num_workers;
-	tpool->workers = malloc(sizeof(pthread_t) * num_workers);
-	if (!tpool->workers) {
-		free(tpool);
+	pthread_mutex_init(&future->lock, NULL);
+	pthread_cond_init(&future->done_condition, NULL);
+	future->result = NULL;
+	future->done = false;
+
+	if (!enqueue_task(tpool, task, arg, future, TPOOL_PRIORITY_NORMAL,
+			  true)) {
+		pthread_mutex_destroy(&future->lock);
+		pthread_cond_destroy(&future->done_condition);
+		free(future);
 		return NULL;
 	}
 
-	tpool->task_queue = NULL;
-	pthread_mutex_init(&tpool->queue_mutex, NULL);
-	pthread_cond_init(&tpool->queue_condition, NULL);
-	tpool->shutdown = false;
+	return future;
+}				/* tpool_submit() */
 
-	// create threads
-	for (int i = 0; i < num_workers; i++) {
-		pthread_create(&tpool->workers[i], NULL, worker_thread, tpool);
+bool tpool_future_done(tpool_future_t * future)
+{
+	if (!future) {
+		return false;
 	}
 
-	return tpool;
-}				/* tpool_create() */
+	pthread_mutex_lock(&future->lock);
+	bool done = future->done;
+	pthread_mutex_unlock(&future->lock);
 
-void tpool_enqueue(tpool_t * tpool, task_func_t task, void *arg)
+	return done;
+}				/* tpool_future_done() */
+
+void *tpool_future_get(tpool_future_t * future)
 {
-	if (!tpool || !task || tpool->shutdown) {
+	if (!future) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&future->lock);
+	while (!future->done) {
+		pthread_cond_wait(&future->done_condition, &future->lock);
+	}
+	void *result = future->result;
+	pthread_mutex_unlock(&future->lock);
+
+	return result;
+}				/* tpool_future_get() */
+
+void tpool_future_destroy(tpool_future_t ** future_ptr)
+{
+	if (!future_ptr || !*future_ptr) {
 		return;
 	}
-	// allocate memory for new task
-	task_t *new_task = malloc(sizeof(task_t));
-	if (!new_task) {
+
+	tpool_future_t *future = *future_ptr;
+
+	// the worker still writes into the future until it is done
+	tpool_future_get(future);
+
+	pthread_mutex_destroy(&future->lock);
+	pthread_cond_destroy(&future->done_condition);
+	free(future);
+	*future_ptr = NULL;
+}				/* tpool_future_destroy() */
+
+void tpool_wait_all(tpool_t * tpool)
+{
+	if (!tpool) {
 		return;
 	}
-	// initialize variables
-	new_task->function = task;
-	new_task->argument = arg;
-	new_task->next = NULL;
 
-	// lock mutex
-	pthread_mutex_lock(&tpool->queue_mutex);
+	pthread_mutex_lock(&tpool->wait_mutex);
+	tpool->waiters++;
+	while (atomic_load(&tpool->outstanding) > 0) {
+		pthread_cond_wait(&tpool->wait_condition, &tpool->wait_mutex);
+	}
+
+	// an aborting tpool_shutdown() waits for the last one to leave
+	if (0 == --tpool->waiters) {
+		pthread_cond_broadcast(&tpool->wait_condition);
+	}
+	pthread_mutex_unlock(&tpool->wait_mutex);
+}				/* tpool_wait_all() */
+
+/*
+ * Shared state of one tpool_parallel_for()/tpool_parallel_reduce() call. It
+ * lives on the caller's stack, the caller does not return before finished is
+ * set.
+ */
+typedef struct range_job {
+	tpool_t *tpool;
+	size_t origin;
+	size_t grain;
+	tpool_range_func_t range_func;
+	tpool_reduce_func_t reduce_func;
+	tpool_combine_func_t combine_func;
+	void *ctx;
+	void **partials;
+	bool *has_partial;
+	atomic_size_t remaining;
+	pthread_mutex_t lock;
+	pthread_cond_t done_condition;
+	bool finished;
+} range_job_t;
+
+typedef struct range_task {
+	range_job_t *job;
+	size_t begin;
+	size_t end;
+} range_task_t;
+
+static void run_range(range_job_t * job, size_t begin, size_t end);
+
+static void *range_task_entry(void *arg)
+{
+	range_task_t *piece = arg;
+	range_job_t *job = piece->job;
+	size_t begin = piece->begin;
+	size_t end = piece->end;
+
+	free(piece);
+	run_range(job, begin, end);
+
+	return NULL;
+}				/* range_task_entry() */
+
+// lazy splitting: only halve a range while the pool is running short of work
+static bool range_wants_split(tpool_t * tpool)
+{
+	size_t queued = atomic_load_explicit(&tpool->pending,
+					     memory_order_relaxed);
+
+	return queued < (size_t)atomic_load(&tpool->active);
+}				/* range_wants_split() */
+
+static bool range_split(range_job_t * job, size_t mid, size_t end)
+{
+	range_task_t *piece = malloc(sizeof(range_task_t));
+	if (!piece) {
+		return false;
+	}
+
+	piece->job = job;
+	piece->begin = mid;
+	piece->end = end;
+
+	// never wait for room, a full pool simply means no split
+	if (!enqueue_task(job->tpool, range_task_entry, piece, NULL,
+			  TPOOL_PRIORITY_NORMAL, false)) {
+		free(piece);
+		return false;
+	}
+
+	return true;
+}				/* range_split() */
+
+static void run_range(range_job_t * job, size_t begin, size_t end)
+{
+	size_t grain = job->grain;
+	size_t first = begin;
+	void *acc = NULL;
+	bool have_acc = false;
+
+	while (begin < end) {
+		// hand the upper half (on a grain boundary) to the pool; in work
+		// stealing mode it lands on our own deque where thieves find it
+		if (end - begin > grain && range_wants_split(job->tpool)) {
+			size_t chunks = (end - begin + grain - 1) / grain;
+			size_t mid = begin + (chunks / 2) * grain;
+
+			if (range_split(job, mid, end)) {
+				end = mid;
+				continue;
+			}
+		}
+
+		size_t stop = end - begin > grain ? begin + grain : end;
+
+		if (job->reduce_func) {
+			void *value = job->reduce_func(begin, stop, job->ctx);
+
+			acc = have_acc ? job->combine_func(acc, value,
+							   job->ctx) : value;
+			have_acc = true;
+		} else {
+			job->range_func(begin, stop, job->ctx);
+		}
+		begin = stop;
+	}
+
+	// every piece starts on a grain boundary, so its slot is unique
+	if (job->reduce_func) {
+		size_t slot = (first - job->origin) / grain;
+		job->partials[slot] = acc;
+		job->has_partial[slot] = true;
+	}
+
+	size_t done = end - first;
+	if (done == atomic_fetch_sub(&job->remaining, done)) {
+		pthread_mutex_lock(&job->lock);
+		job->finished = true;
+		pthread_cond_broadcast(&job->done_condition);
+		pthread_mutex_unlock(&job->lock);
+	}
+}				/* run_range() */
+
+static void range_job_run(range_job_t * job, size_t begin, size_t end)
+{
+	tpool_t *tpool = job->tpool;
+	worker_t *self = current_worker;
+
+	if (!self || self->tpool != tpool) {
+		self = NULL;
+	}
+
+	atomic_init(&job->remaining, end - begin);
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->done_condition, NULL);
+	job->finished = false;
+
+	// the caller works on the range too
+	run_range(job, begin, end);
+
+	// then helps with whatever is queued, which also keeps nested calls
+	// from a worker from starving the pool
+	task_t task;
+	while (atomic_load(&job->remaining) > 0 && find_task(tpool, self, &task)) {
+		run_task(tpool, self, &task);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	while (!job->finished) {
+		pthread_cond_wait(&job->done_condition, &job->lock);
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->done_condition);
+}				/* range_job_run() */
+
+bool tpool_parallel_for(tpool_t * tpool, size_t begin, size_t end,
+			size_t grain, tpool_range_func_t func, void *ctx)
+{
+	if (!tpool || !func || begin > end || tpool->shutdown) {
+		return false;
+	}
+
+	if (begin == end) {
+		return true;
+	}
+
+	range_job_t job = { 0 };
+	job.tpool = tpool;
+	job.origin = begin;
+	job.grain = grain ? grain : 1;
+	job.range_func = func;
+	job.ctx = ctx;
+
+	range_job_run(&job, begin, end);
+
+	return true;
+}				/* tpool_parallel_for() */
+
+void *tpool_parallel_reduce(tpool_t * tpool, size_t begin, size_t end,
+			    size_t grain, tpool_reduce_func_t func,
+			    tpool_combine_func_t combine, void *ctx)
+{
+	if (!tpool || !func || !combine || begin >= end || tpool->shutdown) {
+		return NULL;
+	}
+
+	range_job_t job = { 0 };
+	job.tpool = tpool;
+	job.origin = begin;
+	job.grain = grain ? grain : 1;
+	job.reduce_func = func;
+	job.combine_func = combine;
+	job.ctx = ctx;
+
+	// one slot per grain sized chunk, only the first chunk of each piece
+	// is filled
+	size_t slots = (end - begin + job.grain - 1) / job.grain;
+	job.partials = malloc(slots * sizeof(void *));
+	job.has_partial = calloc(slots, sizeof(bool));
+	if (!job.partials || !job.has_partial) {
+		free(job.partials);
+		free(job.has_partial);
+		return NULL;
+	}
+
+	range_job_run(&job, begin, end);
+
+	// fold the pieces left to right so combine need not be commutative
+	void *result = NULL;
+	bool have_result = false;
+	for (size_t i = 0; i < slots; i++) {
+		if (!job.has_partial[i]) {
+			continue;
+		}
+		result = have_result ? combine(result, job.partials[i],
+					       ctx) : job.partials[i];
+		have_result = true;
+	}
+
+	free(job.partials);
+	free(job.has_partial);
+
+	return result;
+}				/* tpool_parallel_reduce() */
+
+static size_t splice_tasks(tpool_t * tpool, task_func_t * tasks, void **args,
+			   size_t n)
+{
+	size_t queued = 0;
+	uint64_t enqueued = tpool->timing ? now_ns() : 0;
+
+	if (TPOOL_WORK_STEALING != tpool->mode) {
+		pthread_mutex_lock(&tpool->queue_mutex);
+		queued = deque_splice(&tpool->task_queue, tasks, args, n,
+				      enqueued);
+
+		// wake only as many sleeping workers as there is new work for
+		if (queued > 0) {
+			signal_sleepers(tpool, queued);
+		}
+		pthread_mutex_unlock(&tpool->queue_mutex);
+
+		return queued;
+	}
 
-	// add new task
-	if (!tpool->task_queue) {
-		tpool->task_queue = new_task;
+	if (current_worker && current_worker->tpool == tpool) {
+		// spawned from a task, keep it local and let idle workers steal
+		pthread_mutex_lock(&current_worker->lock);
+		queued = deque_splice(&current_worker->deque, tasks, args, n,
+				      enqueued);
+		pthread_mutex_unlock(&current_worker->lock);
 	} else {
+		// one contiguous chunk per worker, one lock round trip each
+		size_t num_workers = atomic_load(&tpool->active);
+		size_t chunk = (n + num_workers - 1) / num_workers;
 
-		task_t *current_task = tpool->task_queue;
+		while (queued < n) {
+			size_t len = n - queued < chunk ? n - queued : chunk;
+			worker_t *target = enqueue_target(tpool);
 
-		while (current_task->next != NULL) {
-			current_task = current_task->next;
+			pthread_mutex_lock(&target->lock);
+			size_t added = deque_splice(&target->deque,
+						    tasks + queued,
+						    args ? args + queued : NULL,
+						    len, enqueued);
+			pthread_mutex_unlock(&target->lock);
+
+			queued += added;
+			if (added < len) {
+				break;
+			}
 		}
-		current_task->next = new_task;
 	}
 
-	// signal thread to process new task
-	pthread_cond_signal(&tpool->queue_condition);
+	wake_workers(tpool, queued);
 
-	// unlock mutex
+	return queued;
+}				/* splice_tasks() */
+
+size_t tpool_enqueue_batch(tpool_t * tpool, task_func_t * tasks, void **args,
+			   size_t n)
+{
+	if (!tpool || !tasks || tpool->shutdown) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (!tasks[i]) {
+			return 0;
+		}
+	}
+
+	atomic_fetch_add(&tpool->outstanding, n);
+
+	// a bounded pool takes the batch in as many pieces as it has room for
+	size_t queued = 0;
+	while (queued < n) {
+		size_t got = reserve_slots(tpool, n - queued, true);
+		if (0 == got) {
+			break;
+		}
+
+		size_t added = splice_tasks(tpool, tasks + queued,
+					    args ? args + queued : NULL, got);
+		queued += added;
+
+		if (added < got) {
+			release_slots(tpool, got - added);
+			break;
+		}
+	}
+
+	// give back the count of tasks that did not make it in
+	tasks_finished(tpool, n - queued);
+
+	return queued;
+}				/* tpool_enqueue_batch() */
+
+static uint64_t counter_read(atomic_uint_fast64_t * counter)
+{
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}				/* counter_read() */
+
+static void worker_stats_read(worker_stats_t * stats,
+			      tpool_worker_stats_t * out)
+{
+	out->tasks_executed = counter_read(&stats->tasks_executed);
+	out->busy_ns = counter_read(&stats->busy_ns);
+	out->idle_ns = counter_read(&stats->idle_ns);
+	out->lock_wait_ns = counter_read(&stats->lock_wait_ns);
+	out->parks = counter_read(&stats->parks);
+	out->spin_wakeups = counter_read(&stats->spin_wakeups);
+	out->yield_wakeups = counter_read(&stats->yield_wakeups);
+	for (int i = 0; i < TPOOL_LATENCY_BUCKETS; i++) {
+		out->latency[i] = counter_read(&stats->latency[i]);
+	}
+}				/* worker_stats_read() */
+
+static void worker_stats_sum(tpool_worker_stats_t * total,
+			     const tpool_worker_stats_t * stats)
+{
+	total->tasks_executed += stats->tasks_executed;
+	total->busy_ns += stats->busy_ns;
+	total->idle_ns += stats->idle_ns;
+	total->lock_wait_ns += stats->lock_wait_ns;
+	total->parks += stats->parks;
+	total->spin_wakeups += stats->spin_wakeups;
+	total->yield_wakeups += stats->yield_wakeups;
+	for (int i = 0; i < TPOOL_LATENCY_BUCKETS; i++) {
+		total->latency[i] += stats->latency[i];
+	}
+}				/* worker_stats_sum() */
+
+bool tpool_stats(tpool_t * tpool, tpool_stats_t * out)
+{
+	if (!tpool || !out) {
+		return false;
+	}
+
+	memset(out, 0, sizeof(*out));
+
+	int num_workers = atomic_load(&tpool->num_workers);
+
+	out->workers = calloc(num_workers, sizeof(*out->workers));
+	if (!out->workers) {
+		return false;
+	}
+	out->num_workers = num_workers;
+
+	for (int i = 0; i < num_workers; i++) {
+		worker_stats_read(&tpool->locals[i]->stats, &out->workers[i]);
+		worker_stats_sum(&out->total, &out->workers[i]);
+	}
+
+	out->queue_depth = atomic_load(&tpool->pending);
+	out->peak_depth = atomic_load(&tpool->peak_pending);
+
+	return true;
+}				/* tpool_stats() */
+
+void tpool_stats_free(tpool_stats_t * stats)
+{
+	if (!stats) {
+		return;
+	}
+
+	free(stats->workers);
+	stats->workers = NULL;
+	stats->num_workers = 0;
+}				/* tpool_stats_free() */
+
+// starts the worker for slot id and waits for it to register
+static bool grow_worker(tpool_t * tpool, int id)
+{
+	pthread_mutex_lock(&tpool->queue_mutex);
+	int started = tpool->started;
 	pthread_mutex_unlock(&tpool->queue_mutex);
-}				/* tpool_enqueue() */
 
-void tpool_shutdown(tpool_t ** tpool_ptr)
+	if (tpool->locals[id]) {
+		atomic_store(&tpool->locals[id]->retired, false);
+	}
+
+	if (!start_worker(tpool, id)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&tpool->queue_mutex);
+	while (tpool->started == started) {
+		pthread_cond_wait(&tpool->ready_condition, &tpool->queue_mutex);
+	}
+	bool ok = NULL != tpool->locals[id];
+	pthread_mutex_unlock(&tpool->queue_mutex);
+
+	if (!ok) {
+		pthread_join(tpool->workers[id], NULL);
+		return false;
+	}
+
+	if (id >= atomic_load(&tpool->num_workers)) {
+		atomic_store(&tpool->num_workers, id + 1);
+	}
+	atomic_store(&tpool->active, id + 1);
+
+	return true;
+}				/* grow_worker() */
+
+bool tpool_resize(tpool_t * tpool, int num_workers)
+{
+	if (!tpool || num_workers < 1 || num_workers > tpool->max_workers
+	    || tpool->shutdown) {
+		return false;
+	}
+	// a worker could end up joining itself
+	if (current_worker && current_worker->tpool == tpool) {
+		return false;
+	}
+
+	pthread_mutex_lock(&tpool->resize_mutex);
+	int active = atomic_load(&tpool->active);
+	bool ok = true;
+
+	if (num_workers > active) {
+		for (int id = active; id < num_workers && ok; id++) {
+			ok = grow_worker(tpool, id);
+		}
+	} else if (num_workers < active) {
+		// stop routing new work to the retiring slots first, whatever
+		// is already on their deques gets stolen by the rest
+		atomic_store(&tpool->active, num_workers);
+
+		pthread_mutex_lock(&tpool->queue_mutex);
+		for (int id = num_workers; id < active; id++) {
+			atomic_store(&tpool->locals[id]->retired, true);
+		}
+		pthread_cond_broadcast(&tpool->queue_condition);
+		pthread_mutex_unlock(&tpool->queue_mutex);
+
+		for (int id = num_workers; id < active; id++) {
+			pthread_join(tpool->workers[id], NULL);
+		}
+	}
+
+	pthread_mutex_unlock(&tpool->resize_mutex);
+
+	return ok;
+}				/* tpool_resize() */
+
+int tpool_size(tpool_t * tpool)
+{
+	return tpool ? atomic_load(&tpool->active) : 0;
+}				/* tpool_size() */
+
+void tpool_shutdown(tpool_t ** tpool_ptr, tpool_shutdown_mode_t mode)
 {
 	if (!tpool_ptr || !*tpool_ptr) {
 		return;
 	}
 
 	tpool_t *tpool = *tpool_ptr;
+
+	// let the workers finish everything already queued
+	if (TPOOL_DRAIN == mode) {
+		tpool_wait_all(tpool);
+	}
 	// lock mutex
 	pthread_mutex_lock(&tpool->queue_mutex);
 
 	// signal threads to shut down
 	tpool->shutdown = true;
 	pthread_cond_broadcast(&tpool->queue_condition);
+	pthread_cond_broadcast(&tpool->ready_condition);
 
 	// unlock mutex
 	pthread_mutex_unlock(&tpool->queue_mutex);
+
+	// release producers blocked on a full pool
+	pthread_mutex_lock(&tpool->space_mutex);
+	pthread_cond_broadcast(&tpool->space_condition);
+	pthread_mutex_unlock(&tpool->space_mutex);
 	pthread_t *ptr = &tpool->workers[0];
 
-	// wait on all threads before exit
-	for (int i = 0; i < tpool->num_workers; i++) {
+	// wait on all threads before exit, retired ones are already joined
+	for (int i = 0; i < tpool->active; i++) {
 		pthread_join(*ptr++, NULL);
 	}
 
 	// free thread array
 	free(tpool->workers);
 	tpool->workers = NULL;
+
+	// free all tasks left in the worker deques
+	for (int i = 0; i < tpool->num_workers; i++) {
+		worker_free(tpool->locals[i]);
+	}
+	free(tpool->locals);
+	tpool->locals = NULL;
 	tpool->num_workers = 0;
+	tpool->active = 0;
+
+	free(tpool->cpus);
+	free(tpool->thread_name);
 
 	// free all tasks in queue
-	task_t *current_task = tpool->task_queue;
-	while (current_task != NULL) {
-		task_t *next_task = current_task->next;
-		free(current_task);
-		current_task = next_task;
-	}
+	deque_free(&tpool->task_queue);
 
-	tpool->task_queue = NULL;
+	// dropped tasks never finish, release tpool_wait_all() callers and
+	// let them leave before their mutex goes away
+	pthread_mutex_lock(&tpool->wait_mutex);
+	atomic_store(&tpool->outstanding, 0);
+	pthread_cond_broadcast(&tpool->wait_condition);
+	while (tpool->waiters > 0) {
+		pthread_cond_wait(&tpool->wait_condition, &tpool->wait_mutex);
+	}
+	pthread_mutex_unlock(&tpool->wait_mutex);
 
-	// Destroy the mutex and condition variable
+	// Destroy the mutexes and condition variables
 	pthread_mutex_destroy(&tpool->queue_mutex);
 	pthread_cond_destroy(&tpool->queue_condition);
+	pthread_cond_destroy(&tpool->ready_condition);
+	pthread_mutex_destroy(&tpool->wait_mutex);
+	pthread_cond_destroy(&tpool->wait_condition);
+	pthread_mutex_destroy(&tpool->space_mutex);
+	pthread_cond_destroy(&tpool->space_condition);
+	pthread_mutex_destroy(&tpool->resize_mutex);
 
 	// free struct
 	free(tpool);
@@ -9,9 +9,167 @@
 #ifndef TPOOL_H
 #define TPOOL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct tpool tpool_t;
+typedef struct tpool_future tpool_future_t;
 typedef void *(*task_func_t)(void *);
 
+/**
+* @brief Loop body for tpool_parallel_for(), handles indices [begin, end).
+*/
+typedef void (*tpool_range_func_t)(size_t begin, size_t end, void *ctx);
+
+/**
+* @brief Map step for tpool_parallel_reduce(), returns the partial result for
+* indices [begin, end).
+*/
+typedef void *(*tpool_reduce_func_t)(size_t begin, size_t end, void *ctx);
+
+/**
+* @brief Combine step for tpool_parallel_reduce(), merges two partial results
+* where lhs covers the lower indices.
+*/
+typedef void *(*tpool_combine_func_t)(void *lhs, void *rhs, void *ctx);
+
+/**
+* @brief Scheduling strategy used by the worker threads.
+*
+* TPOOL_SHARED_QUEUE: every task goes through one queue guarded by one mutex.
+* TPOOL_WORK_STEALING: each worker owns a deque. Workers push and pop their own
+* work at one end, idle workers steal from the other end of a busy worker.
+*/
+typedef enum tpool_mode {
+	TPOOL_SHARED_QUEUE,
+	TPOOL_WORK_STEALING
+} tpool_mode_t;
+
+/**
+* @brief Priority lanes, a worker always drains higher lanes first.
+*
+* In TPOOL_WORK_STEALING mode TPOOL_PRIORITY_HIGH tasks go to a pool wide lane
+* every worker checks before its own deque, so they overtake queued bulk work
+* anywhere in the pool.
+*/
+typedef enum tpool_priority {
+	TPOOL_PRIORITY_HIGH,
+	TPOOL_PRIORITY_NORMAL,
+	TPOOL_PRIORITY_LOW,
+	TPOOL_PRIORITY_LEVELS
+} tpool_priority_t;
+
+/**
+* @brief How worker threads are pinned to cpus.
+*
+* TPOOL_AFFINITY_NONE: the scheduler places workers freely.
+* TPOOL_AFFINITY_CORE: worker i runs on exactly one cpu, cpus[i % num_cpus].
+* TPOOL_AFFINITY_SET: every worker may run on any cpu in cpus.
+*
+* Pinned workers allocate their own state after pinning, so under Linux's
+* first-touch policy it lives on the worker's local NUMA node.
+*/
+typedef enum tpool_affinity {
+	TPOOL_AFFINITY_NONE,
+	TPOOL_AFFINITY_CORE,
+	TPOOL_AFFINITY_SET
+} tpool_affinity_t;
+
+/**
+* @brief What tpool_shutdown() does with tasks that have not run yet.
+*
+* TPOOL_DRAIN: wait until every queued task has run, then stop the workers.
+* TPOOL_ABORT: stop the workers once their current task returns, queued tasks
+* are dropped and their futures complete with NULL.
+*/
+typedef enum tpool_shutdown_mode {
+	TPOOL_DRAIN,
+	TPOOL_ABORT
+} tpool_shutdown_mode_t;
+
+/**
+* @brief Creation time options for tpool_create_opts().
+*
+* @param mode: Scheduling strategy for the pool.
+* @param capacity: Maximum number of queued (not yet running) tasks, 0 for
+* unbounded. Blocking enqueues wait for room, tpool_try_enqueue() fails.
+* Tasks enqueued from inside a running task are never held back.
+* @param affinity: Cpu pinning policy for the workers.
+* @param cpus: Cpu ids used by affinity, NULL for every cpu the process may
+* run on. A worker that cannot be pinned as asked fails tpool_create_opts()
+* and tpool_resize().
+* @param num_cpus: Number of entries in cpus.
+* @param thread_name: Optional prefix, workers are named "<prefix>-<id>"
+* (truncated to 15 characters) so profilers can tell them apart.
+* @param spin_count: Idle policy, polls for new work this many times with a
+* cpu pause hint before yielding.
+* @param yield_count: Idle policy, then polls this many times with
+* sched_yield() before parking on a condition variable. Both 0 parks at once,
+* raising them trades cpu burn for wake-up latency.
+* @param timing: Also collect busy, idle and lock wait time and the
+* enqueue-to-start latency histogram, at the cost of a clock read on every
+* enqueue and around every task.
+* @param max_workers: Upper bound for tpool_resize(), 0 for the number of
+* online cpus. Never less than the initial worker count.
+*/
+typedef struct tpool_options {
+	tpool_mode_t mode;
+	size_t capacity;
+	tpool_affinity_t affinity;
+	const int *cpus;
+	int num_cpus;
+	const char *thread_name;
+	unsigned int spin_count;
+	unsigned int yield_count;
+	bool timing;
+	int max_workers;
+} tpool_options_t;
+
+// latency histogram bucket i counts tasks that waited [2^i, 2^(i+1)) ns
+#define TPOOL_LATENCY_BUCKETS 32
+
+/**
+* @brief Counters of a single worker. Times and latencies stay 0 unless the
+* pool was created with the timing option.
+*
+* @param tasks_executed: Tasks run to completion.
+* @param busy_ns: Time spent running tasks.
+* @param idle_ns: Time spent spinning, yielding or parked without work.
+* @param lock_wait_ns: Time spent blocked on contended queue locks.
+* @param parks: Times a worker went to sleep on the condition variable.
+* @param spin_wakeups: Times a worker found work while spinning.
+* @param yield_wakeups: Times a worker found work while yielding.
+* @param latency: Histogram of enqueue-to-start latency, log2 ns buckets.
+*/
+typedef struct tpool_worker_stats {
+	uint64_t tasks_executed;
+	uint64_t busy_ns;
+	uint64_t idle_ns;
+	uint64_t lock_wait_ns;
+	uint64_t parks;
+	uint64_t spin_wakeups;
+	uint64_t yield_wakeups;
+	uint64_t latency[TPOOL_LATENCY_BUCKETS];
+} tpool_worker_stats_t;
+
+/**
+* @brief Snapshot of pool counters.
+*
+* @param total: Sum of all worker counters.
+* @param workers: Per-worker counters, release with tpool_stats_free().
+* @param num_workers: Length of workers.
+* @param queue_depth: Tasks queued but not yet started.
+* @param peak_depth: Highest queue depth seen since the pool was created.
+*/
+typedef struct tpool_stats {
+	tpool_worker_stats_t total;
+	tpool_worker_stats_t *workers;
+	int num_workers;
+	size_t queue_depth;
+	size_t peak_depth;
+} tpool_stats_t;
+
 /**
 * @brief Allocate and initialize a thread pool with the specified number of worker threads.
 *
@@ -21,21 +179,223 @@ typedef void *(*task_func_t)(void *);
 */
 tpool_t *tpool_create(int num_workers);
 
+/**
+* @brief Allocate and initialize a thread pool using the supplied options.
+*
+* @param num_workers: The number of worker threads to create.
+* @param options: Pool options, NULL behaves like tpool_create().
+*
+* @return Pointer to the newly created thread pool, or NULL on error, which
+* includes cpus the workers cannot be pinned to.
+*/
+tpool_t *tpool_create_opts(int num_workers, const tpool_options_t * options);
+
 /**
 * @brief Add a new task to the thread pool's task queue.
 *
+* In work stealing mode a task enqueued from inside a running task goes to the
+* calling worker's own deque, other callers are spread across all workers.
+*
+* Runs at TPOOL_PRIORITY_NORMAL and blocks while a bounded pool is full.
+*
 * @param tpool: Pointer to the thread pool to which the task should be added.
 * @param task: Function pointer to the task to be added.
 * @param arg: An argument to be passed to the task function.
+*
+* @return true if the task was queued, false on shutdown or out of memory.
 */
-void tpool_enqueue(tpool_t * tpool, task_func_t task, void *arg);
+bool tpool_enqueue(tpool_t * tpool, task_func_t task, void *arg);
+
+/**
+* @brief Add a new task to the given priority lane, blocking while a bounded
+* pool is full.
+*
+* @param tpool: Pointer to the thread pool to which the task should be added.
+* @param task: Function pointer to the task to be added.
+* @param arg: An argument to be passed to the task function.
+* @param priority: Lane to queue the task on.
+*
+* @return true if the task was queued, false on shutdown or out of memory.
+*/
+bool tpool_enqueue_priority(tpool_t * tpool, task_func_t task, void *arg,
+			    tpool_priority_t priority);
+
+/**
+* @brief Add a new task without waiting for room in a bounded pool.
+*
+* @param tpool: Pointer to the thread pool to which the task should be added.
+* @param task: Function pointer to the task to be added.
+* @param arg: An argument to be passed to the task function.
+* @param priority: Lane to queue the task on.
+*
+* @return true if the task was queued, false if the pool is full, shutting
+* down or out of memory.
+*/
+bool tpool_try_enqueue(tpool_t * tpool, task_func_t task, void *arg,
+		       tpool_priority_t priority);
+
+/**
+* @brief Add n tasks to the thread pool in one submission.
+*
+* The queue lock is taken once (once per target deque in work stealing mode)
+* and at most n sleeping workers are woken. A bounded pool takes the batch in
+* as many pieces as it has room for, blocking in between.
+*
+* @param tpool: Pointer to the thread pool to which the tasks should be added.
+* @param tasks: Array of n task functions.
+* @param args: Array of n arguments, or NULL to pass NULL to every task.
+* @param n: Number of tasks to add.
+*
+* @return Number of tasks queued, less than n on shutdown or out of memory.
+*/
+size_t tpool_enqueue_batch(tpool_t * tpool, task_func_t * tasks, void **args,
+			   size_t n);
+
+/**
+* @brief Add a new task to the thread pool and return a handle to its result.
+*
+* @param tpool: Pointer to the thread pool to which the task should be added.
+* @param task: Function pointer to the task to be added.
+* @param arg: An argument to be passed to the task function.
+*
+* @return Future carrying the task's return value, or NULL on error. The
+* caller releases it with tpool_future_destroy().
+*/
+tpool_future_t *tpool_submit(tpool_t * tpool, task_func_t task, void *arg);
+
+/**
+* @brief Check whether the task behind a future has finished.
+*
+* @param future: Future returned by tpool_submit().
+*
+* @return true once the task has run (or was discarded by shutdown).
+*/
+bool tpool_future_done(tpool_future_t * future);
+
+/**
+* @brief Block until the task behind a future has finished.
+*
+* @param future: Future returned by tpool_submit().
+*
+* @return The value returned by the task, NULL if shutdown discarded it.
+*/
+void *tpool_future_get(tpool_future_t * future);
+
+/**
+* @brief Wait for the task to finish, then free the future.
+*
+* @param future: A pointer to the future to free, set to NULL afterwards.
+*/
+void tpool_future_destroy(tpool_future_t ** future);
+
+/**
+* @brief Block until every task enqueued so far, and every task those tasks
+* enqueue, has finished. The pool stays usable afterwards.
+*
+* Must not be called from inside a task running on the same pool. Also
+* returns once a TPOOL_ABORT shutdown has dropped the tasks still queued.
+*
+* @param tpool: Pointer to the thread pool to wait on.
+*/
+void tpool_wait_all(tpool_t * tpool);
+
+/**
+* @brief Run func over [begin, end) on the pool and wait for it to finish.
+*
+* The calling thread works on the range as well. Ranges are halved on grain
+* boundaries only while the pool is short of queued work, so busy pools run
+* large pieces and idle workers pick up (or steal) the upper halves. func is
+* called on pieces of at most grain indices.
+*
+* @param tpool: Pointer to the thread pool to run on.
+* @param begin: First index.
+* @param end: One past the last index.
+* @param grain: Largest piece handed to func, 0 is treated as 1.
+* @param func: Loop body.
+* @param ctx: Passed through to func.
+*
+* @return true once every index was processed, false on invalid arguments.
+*/
+bool tpool_parallel_for(tpool_t * tpool, size_t begin, size_t end,
+			size_t grain, tpool_range_func_t func, void *ctx);
+
+/**
+* @brief Parallel map/reduce over [begin, end), split like
+* tpool_parallel_for().
+*
+* func produces a partial result for each piece of at most grain indices and
+* combine merges neighbouring partials. Partials are always combined in index
+* order, so combine only needs to be associative.
+*
+* @param tpool: Pointer to the thread pool to run on.
+* @param begin: First index.
+* @param end: One past the last index.
+* @param grain: Largest piece handed to func, 0 is treated as 1.
+* @param func: Map step.
+* @param combine: Combine step.
+* @param ctx: Passed through to func and combine.
+*
+* @return The combined result, or NULL on an empty range or error.
+*/
+void *tpool_parallel_reduce(tpool_t * tpool, size_t begin, size_t end,
+			    size_t grain, tpool_reduce_func_t func,
+			    tpool_combine_func_t combine, void *ctx);
+
+/**
+* @brief Take a snapshot of the pool's counters. Counters are kept per worker
+* and read without locking, so the snapshot is cheap but not atomic.
+*
+* @param tpool: Pointer to the thread pool to inspect.
+* @param out: Filled with the current counters.
+*
+* @return true on success, false on invalid arguments or allocation failure.
+*/
+bool tpool_stats(tpool_t * tpool, tpool_stats_t * out);
+
+/**
+* @brief Release the per-worker array of a snapshot filled by tpool_stats().
+*
+* @param stats: Snapshot to release, may be NULL.
+*/
+void tpool_stats_free(tpool_stats_t * stats);
+
+/**
+* @brief Change the number of running worker threads.
+*
+* Growing starts new workers, shrinking retires the highest numbered ones
+* after their current task and waits for them to exit. Tasks left on a
+* retired worker's deque are stolen by the remaining workers. Must not be
+* called from inside a task or concurrently with tpool_shutdown().
+*
+* @param tpool: Pointer to the thread pool to resize.
+* @param num_workers: New worker count, between 1 and the pool's max_workers.
+*
+* @return true on success. false on invalid arguments, when called from a
+* worker, or when a new thread failed to start, in which case the pool keeps
+* the workers that did start.
+*/
+bool tpool_resize(tpool_t * tpool, int num_workers);
+
+/**
+* @brief Get the number of running worker threads.
+*
+* @param tpool: Pointer to the thread pool to inspect.
+*
+* @return The current worker count, 0 for a NULL pool.
+*/
+int tpool_size(tpool_t * tpool);
 
 /**
 * @brief Shut down the thread pool and clean up all resources.
 *
+* Threads blocked in tpool_wait_all() are released, and the pool is only freed
+* after they have returned.
+*
 * @param tpool: A pointer to the thread pool to shut down.
+* @param mode: TPOOL_DRAIN to run every queued task first, TPOOL_ABORT to drop
+* them.
 */
-void tpool_shutdown(tpool_t ** tpool);
+void tpool_shutdown(tpool_t ** tpool, tpool_shutdown_mode_t mode);
 
 #endif				/* TPOOL_H */
 